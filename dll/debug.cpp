@@ -1,8 +1,89 @@
+#include <algorithm>
 #include "runtime/ebl.hpp"
 #include "runtime/listBuilder.hpp"
 
 using namespace ebl;
 
+// Prepends (key . val) to the alist in list. The key is interned as a
+// symbol, or with stringKey, left as a string.
+static void prependEntry(Environment& env, Handle<Value>& list,
+                         const char* key, ValuePtr val, bool stringKey = false)
+{
+    HandleScope scope(env);
+    Handle<Value> value(env, val);
+    Handle<Value> name(env, env.create<String>(key, strlen(key)));
+    if (not stringKey) {
+        name = env.getContext()->intern(name.slot().cast<String>());
+    }
+    Handle<Value> entry(env, env.create<Pair>(name.slot(), value.slot()));
+    list = env.create<Pair>(entry.slot(), list.slot());
+}
+
+static ValuePtr gcStatsEntry(Environment& env, const GCStats& stats)
+{
+    using namespace std::chrono;
+    HandleScope scope(env);
+    auto integer = [&](size_t val) -> ValuePtr {
+        return env.create<Integer>((Integer::Rep)val);
+    };
+    Handle<Value> objects(env, env.getNull());
+    for (TypeId t = 0; t < typeCount; ++t) {
+        if (stats.liveObjects_[t]) {
+            prependEntry(env, objects, typeInfoTable[t].name_,
+                         integer(stats.liveObjects_[t]), true);
+        }
+    }
+    Handle<Value> entry(env, env.getNull());
+    prependEntry(env, entry, "live-objects", objects);
+    prependEntry(env, entry, "persistents-scanned",
+                 integer(stats.persistentsScanned_));
+    prependEntry(env, entry, "breaks", integer(stats.breaks_));
+    prependEntry(env, entry, "live-bytes", integer(stats.bytesLive_));
+    prependEntry(env, entry, "finalized", integer(stats.finalized_));
+    prependEntry(env, entry, "reclaimed-bytes",
+                 integer(stats.bytesReclaimed_));
+    prependEntry(
+        env, entry, "compact-us",
+        integer(duration_cast<microseconds>(stats.compactTime_).count()));
+    prependEntry(env, entry, "mark-us",
+                 integer(duration_cast<microseconds>(stats.markTime_).count()));
+    prependEntry(env, entry, "incremental", env.getBool(stats.incremental_));
+    const auto since = stats.finished_.time_since_epoch();
+    prependEntry(
+        env, entry, "finished",
+        env.create<Float>(duration_cast<duration<double>>(since).count()));
+    prependEntry(env, entry, "sequence", integer(stats.sequence_));
+    return entry;
+}
+
+static ValuePtr allocationSiteEntry(Environment& env,
+                                    const AllocationSite& site, size_t samples,
+                                    size_t interval)
+{
+    Context& context = *env.getContext();
+    HandleScope scope(env);
+    auto integer = [&](size_t val) -> ValuePtr {
+        return env.create<Integer>((Integer::Rep)val);
+    };
+    Handle<Value> entry(env, env.getNull());
+    prependEntry(env, entry, "bytes", integer(samples * interval));
+    prependEntry(env, entry, "samples", integer(samples));
+    const char* type = typeInfoTable[site.type_].name_;
+    prependEntry(env, entry, "type", env.create<String>(type, strlen(type)));
+    if (site.native_) {
+        prependEntry(env, entry, "native",
+                     env.create<String>(
+                         AllocationProfile::describeNative(context, site)));
+    } else {
+        prependEntry(env, entry, "native", env.getBool(false));
+    }
+    prependEntry(env, entry, "ip", integer(site.ip_));
+    prependEntry(
+        env, entry, "function",
+        env.create<String>(AllocationProfile::describeFunction(context, site)));
+    return entry;
+}
+
 static struct {
     const char* name_;
     const char* docstring_;
@@ -33,9 +114,64 @@ static struct {
               env.create<Integer>((Integer::Rep)stat.used_),
               env.create<Integer>((Integer::Rep)stat.remaining_));
       }},
+     {"heap-snapshot", "(heap-snapshot fname) -> null, write a snapshot of "
+                       "the heap to fname, for ebl-heap-analyze", 1,
+      [](Environment& env, const Arguments& args) -> ValuePtr {
+          const auto fname = checkedCast<String>(args[0])->toAscii();
+          env.getContext()->writeHeapSnapshot(fname);
+          return env.getNull();
+      }},
+     {"profile-allocations", "(profile-allocations bytes) -> null, start "
+                             "sampling allocations, about once every bytes, "
+                             "or stop if bytes is zero", 1,
+      [](Environment& env, const Arguments& args) -> ValuePtr {
+          const auto interval = checkedCast<Integer>(args[0])->value();
+          if (interval < 0) {
+              throw std::runtime_error("negative sampling interval");
+          }
+          env.getContext()->profileAllocations(interval);
+          return env.getNull();
+      }},
+     {"allocation-sites", "(allocation-sites) -> list of alists describing "
+                          "sampled allocation sites, most samples first", 0,
+      [](Environment& env, const Arguments&) -> ValuePtr {
+          auto profile = env.getContext()->allocationProfile();
+          if (not profile) {
+              return env.getNull();
+          }
+          using Sample = std::pair<AllocationSite, size_t>;
+          std::vector<Sample> samples(profile->samples().begin(),
+                                      profile->samples().end());
+          std::sort(samples.begin(), samples.end(),
+                    [](const Sample& a, const Sample& b) {
+                        return a.second > b.second;
+                    });
+          LazyListBuilder builder(env);
+          for (auto& sample : samples) {
+              builder.pushBack(allocationSiteEntry(
+                  env, sample.first, sample.second, profile->interval()));
+          }
+          return builder.result();
+      }},
+     {"gc-stats", "(gc-stats) -> list of alists describing recent collections, "
+                  "most recent first", 0,
+      [](Environment& env, const Arguments&) -> ValuePtr {
+          // Building the list may run the collector, which records more
+          // history, so it's copied first.
+          const auto& history = env.getContext()->gcHistory();
+          std::vector<GCStats> recent;
+          for (size_t i = 0; i < history.size(); ++i) {
+              recent.push_back(history[i]);
+          }
+          LazyListBuilder builder(env);
+          for (auto& stats : recent) {
+              builder.pushBack(gcStatsEntry(env, stats));
+          }
+          return builder.result();
+      }},
      {"sizeof", "(sizeof obj) -> number of bytes that obj occupies in memory", 1,
       [](Environment& env, const Arguments& args) -> ValuePtr {
-          return env.create<Integer>(Integer::Rep(typeInfo(args[0]).size_));
+          return env.create<Integer>(Integer::Rep(valueSize(args[0])));
       }}
 };
 
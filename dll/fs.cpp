@@ -51,12 +51,11 @@ static struct {
      {"write", 1, "(write file obj ...) -> write representations of objects to file",
       [](ebl::Environment& env, const ebl::Arguments& args) -> ebl::ValuePtr {
           auto file = ebl::checkedCast<ebl::RawPointer>(args[0])->value();
-          std::stringstream format;
+          std::string result;
           for (size_t i = 1; i < args.count(); ++i) {
-              ebl::print(env, args[i], format, false);
+              ebl::print(env, args[i], result, false);
           }
-          const auto result = format.str();
-          fwrite(result.c_str(), result.size(), 1, (FILE*)file);
+          fwrite(result.data(), result.size(), 1, (FILE*)file);
           return env.getNull();
       }},
 };
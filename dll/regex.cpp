@@ -0,0 +1,1035 @@
+#include "runtime/ebl.hpp"
+#include "runtime/listBuilder.hpp"
+#include <algorithm>
+#include <bitset>
+#include <cctype>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+using namespace ebl;
+
+// Regular expressions over UTF-8 text. A pattern is compiled once into an
+// NFA over bytes, where a glyph is a sequence of byte transitions, and
+// matched by a DFA that's built from the NFA lazily: each DFA state is a set
+// of NFA states, and a transition is only computed the first time that it's
+// taken. Matching then costs one table lookup per byte. A search reads the
+// text once forwards, to find where the leftmost match ends, and then
+// backwards from there, with a DFA for the reversed pattern, to find where
+// it begins.
+//
+// Supported syntax: literals, ., [...] and [^...] classes with ASCII ranges,
+// \d \w \s and their negations \D \W \S, the escapes \n \t \r, grouping with
+// (...), alternation with |, the quantifiers * + ?, and the anchors ^ and $,
+// for the beginning and end of the text. Matches are leftmost, and then
+// longest.
+
+namespace {
+
+// A sequence of byte ranges, one per byte of a glyph.
+using ByteSeq = std::vector<std::pair<uint8_t, uint8_t>>;
+
+// The sequences that match any multibyte glyph.
+const std::vector<ByteSeq> multibyteGlyphs = {
+    {{0xc0, 0xdf}, {0x80, 0xbf}},
+    {{0xe0, 0xef}, {0x80, 0xbf}, {0x80, 0xbf}},
+    {{0xf0, 0xf7}, {0x80, 0xbf}, {0x80, 0xbf}, {0x80, 0xbf}}};
+
+struct State {
+    // Begin and End are the anchors ^ and $, which consume no input.
+    enum Kind { Range, Split, Match, Begin, End } kind_;
+    uint8_t low_;
+    uint8_t high_;
+    int out_;
+    int out1_;
+};
+
+// The NFA that matches the reverse of what nfa matches, i.e. the same text,
+// read backwards from where a match ends. The anchors swap places. Its
+// states start with one Split per state of nfa, which fans out to the
+// states' predecessors, so the reversed start state is that of nfa's Match.
+std::vector<State> reversed(const std::vector<State>& nfa, int start)
+{
+    std::vector<State> result(nfa.size(), {State::Split, 0, 0, -1, -1});
+    std::vector<std::vector<int>> predecessors(nfa.size());
+    auto add = [&](const State& state) {
+        result.push_back(state);
+        return int(result.size() - 1);
+    };
+    for (size_t from = 0; from < nfa.size(); ++from) {
+        const auto& state = nfa[from];
+        int target = from;
+        switch (state.kind_) {
+        case State::Range:
+            target = add({State::Range, state.low_, state.high_, target, -1});
+            break;
+        case State::Begin:
+            target = add({State::End, 0, 0, target, -1});
+            break;
+        case State::End:
+            target = add({State::Begin, 0, 0, target, -1});
+            break;
+        case State::Split:
+        case State::Match:
+            break;
+        }
+        for (int to : {state.out_, state.out1_}) {
+            if (to >= 0) {
+                predecessors[to].push_back(target);
+            }
+        }
+    }
+    predecessors[start].push_back(add({State::Match, 0, 0, -1, -1}));
+    for (size_t to = 0; to < nfa.size(); ++to) {
+        int fork = to;
+        for (size_t i = 0; i < predecessors[to].size(); ++i) {
+            if (i == 0) {
+                result[fork].out_ = predecessors[to][i];
+            } else {
+                const int next =
+                    add({State::Split, 0, 0, predecessors[to][i], -1});
+                result[fork].out1_ = next;
+                fork = next;
+            }
+        }
+    }
+    return result;
+}
+
+// A DFA, built from an NFA lazily.
+//
+// It also has the states for an unanchored search, which finds where the
+// leftmost, longest match ends in a single pass. Their NFA states are split
+// into groups by the position that a match would begin at, earliest first.
+// A state reached from an earlier group is left out of the later ones, and
+// once a group matches, the groups after it are dropped, and no new ones
+// begin.
+class Dfa {
+public:
+    enum : int { dead = 0 };
+
+    Dfa(std::vector<State> nfa, int start) : nfa_(std::move(nfa))
+    {
+        startStates_ = closure({start}, false);
+        for (int state : closure(startStates_, false, true)) {
+            startAcceptsAtEnd_ |= nfa_[state].kind_ == State::Match;
+        }
+        start_ = addDfaState(startStates_);
+        startAtBegin_ = addDfaState(closure({start}, true));
+        idle_ = addDfaState({openMark});
+        searchStart_ = addDfaState(searchKey(dfa_[start_].states_));
+        searchStartAtBegin_ =
+            addDfaState(searchKey(dfa_[startAtBegin_].states_));
+    }
+
+    Dfa(const Dfa&) = delete;
+
+    // The state for a match that begins at atBegin, or elsewhere. Unless
+    // atBegin, ^ can't match there.
+    int start(bool atBegin) const
+    {
+        return atBegin ? startAtBegin_ : start_;
+    }
+
+    // As start(), for a search that begins there.
+    int searchStart(bool atBegin) const
+    {
+        return atBegin ? searchStartAtBegin_ : searchStart_;
+    }
+
+    // Whether a search has no match in progress, in which case it can skip
+    // ahead to the next position where one could begin.
+    bool idle(int state) const
+    {
+        return state == idle_;
+    }
+
+    bool accepts(int state, bool atEnd) const
+    {
+        return atEnd ? dfa_[state].acceptingAtEnd_ : dfa_[state].accepting_;
+    }
+
+    int step(int state, uint8_t byte)
+    {
+        const int known = dfa_[state].next_[byte];
+        if (known not_eq -1) {
+            return known;
+        }
+        const auto& key = dfa_[state].states_;
+        auto next = not key.empty() and key.front() < 0
+                        ? searchTransition(key, byte)
+                        : transition(key, byte);
+        if (dfa_.size() >= maxDfaStates) {
+            // Rather than growing without bound, start over, keeping only
+            // the start states and the one being left.
+            int* const kept[] = {&start_, &startAtBegin_, &idle_,
+                                 &searchStart_, &searchStartAtBegin_, &state};
+            std::vector<std::vector<int>> keys;
+            for (int* id : kept) {
+                keys.push_back(dfa_[*id].states_);
+            }
+            dfa_.clear();
+            dfaIds_.clear();
+            for (size_t i = 0; i < keys.size(); ++i) {
+                *kept[i] = addDfaState(std::move(keys[i]));
+            }
+        }
+        const int id = addDfaState(std::move(next));
+        dfa_[state].next_[byte] = id;
+        return id;
+    }
+
+private:
+    struct DfaState {
+        // Sorted NFA states, or for a search, openMark or closedMark and
+        // then each group of sorted NFA states, preceded by groupMark.
+        std::vector<int> states_;
+        std::vector<int> next_; // Transitions by byte, unknown is -1
+        bool accepting_;
+        bool acceptingAtEnd_; // With $ satisfied
+    };
+
+    static constexpr const size_t maxDfaStates = 2048;
+    // Markers within the NFA states of a search.
+    enum : int {
+        groupMark = -1,
+        openMark = -2, // No match found yet
+        closedMark = -3
+    };
+
+    static std::vector<int> searchKey(const std::vector<int>& states)
+    {
+        std::vector<int> key{openMark};
+        if (not states.empty()) {
+            key.push_back(groupMark);
+            key.insert(key.end(), states.begin(), states.end());
+        }
+        return key;
+    }
+
+    // The NFA states reachable from states without consuming input. Begin
+    // is passed only atBegin, and End only atEnd; otherwise End is kept, to
+    // be passed if the text ends there. Negative states are skipped.
+    std::vector<int> closure(std::vector<int> stack, bool atBegin,
+                             bool atEnd = false) const
+    {
+        std::vector<int> result;
+        std::vector<bool> seen(nfa_.size());
+        while (not stack.empty()) {
+            const int state = stack.back();
+            stack.pop_back();
+            if (state < 0 or seen[state]) {
+                continue;
+            }
+            seen[state] = true;
+            const auto kind = nfa_[state].kind_;
+            if (kind == State::Split) {
+                stack.push_back(nfa_[state].out1_);
+                stack.push_back(nfa_[state].out_);
+            } else if (kind == State::Begin) {
+                if (atBegin) {
+                    stack.push_back(nfa_[state].out_);
+                }
+            } else if (kind == State::End and atEnd) {
+                stack.push_back(nfa_[state].out_);
+            } else {
+                result.push_back(state);
+            }
+        }
+        std::sort(result.begin(), result.end());
+        return result;
+    }
+
+    std::vector<int> transition(const std::vector<int>& states,
+                                uint8_t byte) const
+    {
+        std::vector<int> next;
+        for (int nfaState : states) {
+            const auto& s = nfa_[nfaState];
+            if (s.kind_ == State::Range and byte >= s.low_ and
+                byte <= s.high_) {
+                next.push_back(s.out_);
+            }
+        }
+        return closure(std::move(next), false);
+    }
+
+    std::vector<int> searchTransition(const std::vector<int>& key,
+                                      uint8_t byte) const
+    {
+        std::vector<int> next{closedMark};
+        std::vector<bool> seen(nfa_.size());
+        auto addGroup = [&](const std::vector<int>& states) {
+            bool empty = true;
+            for (int state : transition(states, byte)) {
+                if (not seen[state]) {
+                    seen[state] = true;
+                    if (empty) {
+                        next.push_back(groupMark);
+                        empty = false;
+                    }
+                    next.push_back(state);
+                }
+            }
+        };
+        bool open = key.front() == openMark;
+        std::vector<int> group;
+        for (size_t i = 1; i < key.size();) {
+            bool matched = false;
+            group.clear();
+            for (++i; i < key.size() and key[i] not_eq groupMark; ++i) {
+                matched |= nfa_[key[i]].kind_ == State::Match;
+                group.push_back(key[i]);
+            }
+            addGroup(group);
+            if (matched) {
+                open = false;
+                break;
+            }
+        }
+        // Matches only begin on glyph boundaries.
+        if (open and (byte & 0xc0) not_eq 0x80) {
+            addGroup(startStates_);
+        }
+        if (open) {
+            next.front() = openMark;
+        }
+        return next;
+    }
+
+    int addDfaState(std::vector<int> states)
+    {
+        if (states.size() == 1 and states.front() < 0 and
+            (states.front() == closedMark or startStates_.empty())) {
+            // A search that has nothing left in progress, and can't begin
+            // anything new.
+            states.clear();
+        }
+        auto found = dfaIds_.find(states);
+        if (found not_eq dfaIds_.end()) {
+            return found->second;
+        }
+        if (dfa_.empty()) {
+            // The dead state, with no NFA states, always comes first.
+            dfa_.push_back({{}, std::vector<int>(256, dead), false, false});
+            dfaIds_[{}] = dead;
+            if (states.empty()) {
+                return dead;
+            }
+        }
+        bool accepting = false;
+        bool anchored = false;
+        for (int state : states) {
+            if (state >= 0) {
+                accepting |= nfa_[state].kind_ == State::Match;
+                anchored |= nfa_[state].kind_ == State::End;
+            }
+        }
+        bool acceptingAtEnd = accepting;
+        if (anchored) {
+            for (int state : closure(states, false, true)) {
+                acceptingAtEnd |= nfa_[state].kind_ == State::Match;
+            }
+        }
+        if (states.front() == openMark) {
+            // A match could still begin at the end.
+            acceptingAtEnd |= startAcceptsAtEnd_;
+        }
+        const int id = dfa_.size();
+        dfaIds_[states] = id;
+        dfa_.push_back({std::move(states), std::vector<int>(256, -1),
+                        accepting, acceptingAtEnd});
+        return id;
+    }
+
+    const std::vector<State> nfa_;
+    std::vector<int> startStates_;
+    bool startAcceptsAtEnd_ = false;
+    std::vector<DfaState> dfa_;
+    std::map<std::vector<int>, int> dfaIds_;
+    int start_ = 0;
+    int startAtBegin_ = 0;
+    int idle_ = 0;
+    int searchStart_ = 0;
+    int searchStartAtBegin_ = 0;
+};
+
+class Regex {
+public:
+    Regex(const std::string& pattern) : pattern_(pattern)
+    {
+        auto body = parseAlternation();
+        if (pos_ not_eq pattern_.size()) {
+            throw error("unexpected )");
+        }
+        const int match = addState({State::Match, 0, 0, -1, -1});
+        patch(body, match);
+        reverse_ = make_unique<Dfa>(reversed(states_, body.start_), match);
+        forward_ = make_unique<Dfa>(std::move(states_), body.start_);
+    }
+
+    Regex(const Regex&) = delete;
+
+    // The end of the longest match that begins at begin, or nullptr. Unless
+    // atBegin, begin isn't the beginning of the text, so ^ can't match there.
+    const char* longestMatch(const char* begin, const char* end, bool atBegin)
+    {
+        int state = forward_->start(atBegin);
+        const char* accepted = nullptr;
+        if (forward_->accepts(state, begin == end)) {
+            accepted = begin;
+        }
+        for (const char* current = begin; current < end; ++current) {
+            state = forward_->step(state, (uint8_t)*current);
+            if (state == Dfa::dead) {
+                break;
+            }
+            if (forward_->accepts(state, current + 1 == end)) {
+                accepted = current + 1;
+            }
+        }
+        return accepted;
+    }
+
+    // Finds the leftmost match that begins at or after from, in the text
+    // [begin, end). Returns false if there isn't one.
+    bool search(const char* begin, const char* from, const char* end,
+                const char*& matchBegin, const char*& matchEnd)
+    {
+        // Matches only begin on glyph boundaries.
+        while (from < end and (*from & 0xc0) == 0x80) {
+            ++from;
+        }
+        const auto& first = firstBytes();
+        int state = forward_->searchStart(from == begin);
+        const char* found = nullptr;
+        const char* current = from;
+        while (state not_eq Dfa::dead) {
+            if (forward_->accepts(state, current == end)) {
+                found = current;
+            }
+            if (current == end) {
+                break;
+            }
+            if (forward_->idle(state)) {
+                const char* next = nextCandidate(current, end, first);
+                if (next not_eq current) {
+                    current = next;
+                    continue;
+                }
+            }
+            state = forward_->step(state, (uint8_t)*current++);
+        }
+        if (not found) {
+            return false;
+        }
+        // The match ending at found that begins furthest back is the
+        // leftmost one. Read backwards, the text ends at begin.
+        state = reverse_->start(found == end);
+        matchBegin = found;
+        for (current = found; current > from;) {
+            state = reverse_->step(state, (uint8_t)*--current);
+            if (state == Dfa::dead) {
+                break;
+            }
+            if (reverse_->accepts(state, current == begin)) {
+                matchBegin = current;
+            }
+        }
+        matchEnd = found;
+        return true;
+    }
+
+    std::mutex& lock()
+    {
+        return lock_;
+    }
+
+private:
+    // A partially built piece of the NFA, with the transitions that still
+    // need to be pointed at whatever follows it. A dangling transition is
+    // encoded as state * 2, plus one for the second branch of a Split.
+    struct Fragment {
+        int start_;
+        std::vector<int> dangling_;
+    };
+
+    std::runtime_error error(const std::string& reason) const
+    {
+        return std::runtime_error("regex " + pattern_ + ": " + reason);
+    }
+
+    int addState(const State& state)
+    {
+        states_.push_back(state);
+        return states_.size() - 1;
+    }
+
+    void patch(const Fragment& frag, int target)
+    {
+        for (int slot : frag.dangling_) {
+            auto& state = states_[slot / 2];
+            (slot % 2 ? state.out1_ : state.out_) = target;
+        }
+    }
+
+    Fragment split(int out, int out1)
+    {
+        const int state = addState({State::Split, 0, 0, out, out1});
+        return {state, {}};
+    }
+
+    Fragment sequence(const ByteSeq& seq)
+    {
+        Fragment result{-1, {}};
+        for (auto& range : seq) {
+            const int state =
+                addState({State::Range, range.first, range.second, -1, -1});
+            if (result.start_ == -1) {
+                result.start_ = state;
+            } else {
+                patch(result, state);
+            }
+            result.dangling_ = {state * 2};
+        }
+        return result;
+    }
+
+    Fragment alternatives(const std::vector<ByteSeq>& seqs)
+    {
+        Fragment result = sequence(seqs.front());
+        for (size_t i = 1; i < seqs.size(); ++i) {
+            auto next = sequence(seqs[i]);
+            auto fork = split(result.start_, next.start_);
+            fork.dangling_ = result.dangling_;
+            fork.dangling_.insert(fork.dangling_.end(), next.dangling_.begin(),
+                                  next.dangling_.end());
+            result = fork;
+        }
+        return result;
+    }
+
+    bool atEnd() const
+    {
+        return pos_ == pattern_.size();
+    }
+
+    Fragment parseAlternation()
+    {
+        auto result = parseConcatenation();
+        while (not atEnd() and pattern_[pos_] == '|') {
+            ++pos_;
+            auto next = parseConcatenation();
+            auto fork = split(result.start_, next.start_);
+            fork.dangling_ = result.dangling_;
+            fork.dangling_.insert(fork.dangling_.end(), next.dangling_.begin(),
+                                  next.dangling_.end());
+            result = fork;
+        }
+        return result;
+    }
+
+    Fragment assertion(State::Kind kind)
+    {
+        const int state = addState({kind, 0, 0, -1, -1});
+        return {state, {state * 2}};
+    }
+
+    Fragment parseConcatenation()
+    {
+        Fragment result{-1, {}};
+        bool empty = true;
+        while (not atEnd() and pattern_[pos_] not_eq '|' and
+               pattern_[pos_] not_eq ')') {
+            auto next = parseRepetition();
+            if (empty) {
+                result = next;
+                empty = false;
+            } else {
+                patch(result, next.start_);
+                result.dangling_ = next.dangling_;
+            }
+        }
+        if (empty) {
+            // Matches the empty string, by way of a Split with one branch.
+            result = split(-1, -1);
+            result.dangling_ = {result.start_ * 2};
+        }
+        return result;
+    }
+
+    Fragment parseRepetition()
+    {
+        auto atom = parseAtom();
+        while (not atEnd()) {
+            const char op = pattern_[pos_];
+            if (op == '*') {
+                auto loop = split(atom.start_, -1);
+                patch(atom, loop.start_);
+                loop.dangling_ = {loop.start_ * 2 + 1};
+                atom = loop;
+            } else if (op == '+') {
+                auto loop = split(atom.start_, -1);
+                patch(atom, loop.start_);
+                atom.dangling_ = {loop.start_ * 2 + 1};
+            } else if (op == '?') {
+                auto fork = split(atom.start_, -1);
+                fork.dangling_ = atom.dangling_;
+                fork.dangling_.push_back(fork.start_ * 2 + 1);
+                atom = fork;
+            } else {
+                break;
+            }
+            ++pos_;
+        }
+        return atom;
+    }
+
+    // Reads the UTF-8 glyph at pos_.
+    ByteSeq parseGlyph()
+    {
+        const size_t size = utf8GlyphSize(pattern_[pos_]);
+        if (size == 0 or pos_ + size > pattern_.size()) {
+            throw error("invalid UTF-8");
+        }
+        ByteSeq seq;
+        for (size_t i = 0; i < size; ++i) {
+            const uint8_t byte = pattern_[pos_++];
+            seq.push_back({byte, byte});
+        }
+        return seq;
+    }
+
+    // Adds the ASCII ranges for the class escape c, e.g. d for \d, to
+    // ranges. Returns false if c isn't a class escape.
+    static bool classEscape(char c, std::bitset<128>& set)
+    {
+        auto range = [&](char low, char high) {
+            for (int i = low; i <= high; ++i) {
+                set.set(i);
+            }
+        };
+        switch (c) {
+        case 'd':
+            range('0', '9');
+            return true;
+        case 'w':
+            range('a', 'z');
+            range('A', 'Z');
+            range('0', '9');
+            set.set('_');
+            return true;
+        case 's':
+            for (char space : {' ', '\t', '\n', '\r', '\f', '\v'}) {
+                set.set(space);
+            }
+            return true;
+        }
+        return false;
+    }
+
+    static char escaped(char c)
+    {
+        switch (c) {
+        case 'n':
+            return '\n';
+        case 't':
+            return '\t';
+        case 'r':
+            return '\r';
+        }
+        return c;
+    }
+
+    // The alternatives matching one glyph, from a set of ASCII bytes, and a
+    // list of multibyte glyphs. A negated set matches every other glyph.
+    static std::vector<ByteSeq> glyphSet(const std::bitset<128>& ascii,
+                                         std::vector<ByteSeq> multibyte,
+                                         bool negate)
+    {
+        std::vector<ByteSeq> seqs;
+        for (int i = 0; i < 128;) {
+            if (ascii.test(i) not_eq negate) {
+                int j = i;
+                while (j + 1 < 128 and ascii.test(j + 1) not_eq negate) {
+                    ++j;
+                }
+                seqs.push_back({{uint8_t(i), uint8_t(j)}});
+                i = j + 1;
+            } else {
+                ++i;
+            }
+        }
+        if (negate) {
+            multibyte = multibyteGlyphs;
+        }
+        seqs.insert(seqs.end(), multibyte.begin(), multibyte.end());
+        return seqs;
+    }
+
+    Fragment parseClass()
+    {
+        bool negate = false;
+        if (not atEnd() and pattern_[pos_] == '^') {
+            negate = true;
+            ++pos_;
+        }
+        std::bitset<128> ascii;
+        std::vector<ByteSeq> multibyte;
+        bool allMultibyte = false;
+        bool first = true;
+        while (true) {
+            if (atEnd()) {
+                throw error("missing ]");
+            }
+            if (pattern_[pos_] == ']' and not first) {
+                ++pos_;
+                break;
+            }
+            first = false;
+            char low = pattern_[pos_];
+            if (low == '\\' and pos_ + 1 < pattern_.size()) {
+                const char e = pattern_[pos_ + 1];
+                std::bitset<128> set;
+                const char lower = std::tolower((unsigned char)e);
+                if (classEscape(lower, set)) {
+                    if (lower == e) {
+                        ascii |= set;
+                    } else {
+                        // A negated escape, like \D, also matches every
+                        // multibyte glyph.
+                        ascii |= ~set;
+                        allMultibyte = true;
+                    }
+                    pos_ += 2;
+                    continue;
+                }
+                low = escaped(pattern_[++pos_]);
+            }
+            if (low & 0x80) {
+                if (negate) {
+                    throw error("negated classes must be ASCII");
+                }
+                multibyte.push_back(parseGlyph());
+                continue;
+            }
+            ++pos_;
+            char high = low;
+            if (pos_ + 1 < pattern_.size() and pattern_[pos_] == '-' and
+                pattern_[pos_ + 1] not_eq ']') {
+                high = pattern_[pos_ + 1];
+                if (high & 0x80 or high < low) {
+                    throw error("invalid range");
+                }
+                pos_ += 2;
+            }
+            for (int i = low; i <= high; ++i) {
+                ascii.set(i);
+            }
+        }
+        if (allMultibyte) {
+            multibyte = multibyteGlyphs;
+            if (negate) {
+                // Only the ASCII glyphs that aren't in the class are left.
+                ascii = ~ascii;
+                multibyte.clear();
+                negate = false;
+            }
+        }
+        if (ascii.none() and multibyte.empty() and not negate) {
+            throw error("empty class");
+        }
+        return alternatives(glyphSet(ascii, multibyte, negate));
+    }
+
+    Fragment parseAtom()
+    {
+        const char c = pattern_[pos_];
+        switch (c) {
+        case '(': {
+            ++pos_;
+            auto group = parseAlternation();
+            if (atEnd() or pattern_[pos_] not_eq ')') {
+                throw error("missing )");
+            }
+            ++pos_;
+            return group;
+        }
+        case '[':
+            ++pos_;
+            return parseClass();
+        case '.':
+            ++pos_;
+            return alternatives(glyphSet({}, {}, true));
+        case '*':
+        case '+':
+        case '?':
+            throw error(std::string("nothing to repeat before ") + c);
+        case '^':
+            ++pos_;
+            return assertion(State::Begin);
+        case '$':
+            ++pos_;
+            return assertion(State::End);
+        case '\\': {
+            if (pos_ + 1 == pattern_.size()) {
+                throw error("trailing \\");
+            }
+            const char e = pattern_[pos_ + 1];
+            std::bitset<128> set;
+            const char lower = std::tolower((unsigned char)e);
+            if (classEscape(lower, set)) {
+                pos_ += 2;
+                return alternatives(glyphSet(set, {}, lower not_eq e));
+            }
+            ++pos_;
+            if (e & 0x80) {
+                return sequence(parseGlyph());
+            }
+            ++pos_;
+            const uint8_t byte = escaped(e);
+            return sequence({{byte, byte}});
+        }
+        default:
+            return sequence(parseGlyph());
+        }
+    }
+
+    // The bytes that can begin a match.
+    const std::bitset<256>& firstBytes()
+    {
+        if (not firstKnown_) {
+            const int start = forward_->start(false);
+            for (int byte = 0; byte < 256; ++byte) {
+                if (forward_->step(start, byte) not_eq Dfa::dead) {
+                    first_.set(byte);
+                }
+            }
+            onlyFirst_ = first_.count() == 1 ? int(firstByte(first_)) : -1;
+            firstKnown_ = true;
+        }
+        return first_;
+    }
+
+    static uint8_t firstByte(const std::bitset<256>& set)
+    {
+        for (int byte = 0; byte < 256; ++byte) {
+            if (set.test(byte)) {
+                return byte;
+            }
+        }
+        return 0;
+    }
+
+    // The first position at or after current that can begin a match, or
+    // end. With a single possible first byte, memchr does the scanning.
+    const char* nextCandidate(const char* current, const char* end,
+                              const std::bitset<256>& first) const
+    {
+        if (onlyFirst_ not_eq -1) {
+            auto found =
+                (const char*)memchr(current, onlyFirst_, end - current);
+            return found ? found : end;
+        }
+        while (current < end and not first.test((uint8_t)*current)) {
+            ++current;
+        }
+        return current;
+    }
+
+    const std::string pattern_;
+    size_t pos_ = 0;
+    std::vector<State> states_;
+    std::unique_ptr<Dfa> forward_;
+    std::unique_ptr<Dfa> reverse_;
+    std::bitset<256> first_;
+    bool firstKnown_ = false;
+    int onlyFirst_ = -1;
+    std::mutex lock_;
+};
+
+// Compiled patterns live for as long as the process, shared by every
+// Context, and are looked up by their source text, so each pattern is only
+// compiled once.
+std::mutex cacheLock;
+std::unordered_map<std::string, std::unique_ptr<Regex>> cache;
+
+Regex& compile(const std::string& pattern)
+{
+    std::lock_guard<std::mutex> guard(cacheLock);
+    auto found = cache.find(pattern);
+    if (found not_eq cache.end()) {
+        return *found->second;
+    }
+    auto regex = make_unique<Regex>(pattern);
+    auto& result = *regex;
+    cache.emplace(pattern, std::move(regex));
+    return result;
+}
+
+// Accepts either a pattern string, or a regex from regex::compile.
+Regex& toRegex(ValuePtr val)
+{
+    if (isType<RawPointer>(val)) {
+        auto address = val.cast<RawPointer>()->value();
+        std::lock_guard<std::mutex> guard(cacheLock);
+        for (auto& entry : cache) {
+            if (entry.second.get() == address) {
+                return *entry.second;
+            }
+        }
+        throw std::runtime_error("pointer is not a compiled regex");
+    }
+    auto pattern = checkedCast<String>(val);
+    return compile(std::string(pattern->data(), pattern->bytes()));
+}
+
+// A String of the text from begin up to end, within str.
+ValuePtr substring(Environment& env, Heap::Ptr<String> str, const char* begin,
+                   const char* end)
+{
+    return env.create<String>(begin, size_t(end - begin),
+                              str->ascii() ? String::Encoding::binary
+                                           : String::Encoding::utf8);
+}
+
+} // namespace
+
+static struct {
+    const char* name_;
+    const char* docstring_;
+    size_t argc_;
+    ebl::CFunction impl_;
+} exports[] = {
+    {"compile", "(compile pattern) -> compiled regex, for the other functions, "
+                "which also accept a pattern string",
+     1,
+     [](Environment& env, const Arguments& args) -> ValuePtr {
+         return env.create<RawPointer>(&toRegex(args[0]));
+     }},
+    {"match?", "(match? regex str) -> whether all of str matches regex", 2,
+     [](Environment& env, const Arguments& args) -> ValuePtr {
+         auto& regex = toRegex(args[0]);
+         auto str = checkedCast<String>(args[1]);
+         const char* end = str->data() + str->bytes();
+         std::lock_guard<std::mutex> guard(regex.lock());
+         return env.getBool(regex.longestMatch(str->data(), end, true) ==
+                            end);
+     }},
+    {"search", "(search regex str [start]) -> (index . match) for the first "
+               "match at or after start, or false",
+     2,
+     [](Environment& env, const Arguments& args) -> ValuePtr {
+         auto& regex = toRegex(args[0]);
+         auto str = checkedCast<String>(args[1]);
+         size_t start = 0;
+         if (args.count() > 2) {
+             const auto index = checkedCast<Integer>(args[2])->value();
+             if (index < 0 or size_t(index) > str->length()) {
+                 throw std::runtime_error("invalid index to search");
+             }
+             start = str->offset(index);
+         }
+         const char* begin = str->data();
+         const char* matchBegin;
+         const char* matchEnd;
+         {
+             std::lock_guard<std::mutex> guard(regex.lock());
+             if (not regex.search(begin, begin + start, begin + str->bytes(),
+                                  matchBegin, matchEnd)) {
+                 return env.getBool(false);
+             }
+         }
+         HandleScope scope(env);
+         Handle<Integer> index(
+             env, env.create<Integer>(
+                      (Integer::Rep)str->glyphAt(matchBegin - begin)));
+         Handle<Value> match(
+             env, substring(env, args[1].cast<String>(), matchBegin, matchEnd));
+         return env.create<Pair>(index.slot(), match.slot());
+     }},
+    {"find-all", "(find-all regex str) -> list of the non-empty matches in "
+                 "str, left to right",
+     2,
+     [](Environment& env, const Arguments& args) -> ValuePtr {
+         auto& regex = toRegex(args[0]);
+         auto str = checkedCast<String>(args[1]);
+         // The text lives outside of the heap, so it stays put while the
+         // matches are allocated.
+         const char* const begin = str->data();
+         const char* const end = begin + str->bytes();
+         std::vector<std::pair<const char*, const char*>> matches;
+         {
+             std::lock_guard<std::mutex> guard(regex.lock());
+             const char* from = begin;
+             const char* matchBegin;
+             const char* matchEnd;
+             while (from <= end and
+                    regex.search(begin, from, end, matchBegin, matchEnd)) {
+                 if (matchEnd == matchBegin) {
+                     from = matchBegin + 1;
+                     continue;
+                 }
+                 matches.push_back({matchBegin, matchEnd});
+                 from = matchEnd;
+             }
+         }
+         HandleScope scope(env);
+         LazyListBuilder builder(env);
+         for (auto& match : matches) {
+             builder.pushBack(substring(env, args[1].cast<String>(),
+                                        match.first, match.second));
+         }
+         return builder.result();
+     }},
+    {"split", "(split regex str) -> list of the substrings of str between "
+              "non-empty matches",
+     2,
+     [](Environment& env, const Arguments& args) -> ValuePtr {
+         auto& regex = toRegex(args[0]);
+         auto str = checkedCast<String>(args[1]);
+         const char* const begin = str->data();
+         const char* const end = begin + str->bytes();
+         std::vector<std::pair<const char*, const char*>> pieces;
+         {
+             std::lock_guard<std::mutex> guard(regex.lock());
+             const char* piece = begin;
+             const char* from = begin;
+             const char* matchBegin;
+             const char* matchEnd;
+             while (from <= end and
+                    regex.search(begin, from, end, matchBegin, matchEnd)) {
+                 if (matchEnd == matchBegin) {
+                     from = matchBegin + 1;
+                     continue;
+                 }
+                 pieces.push_back({piece, matchBegin});
+                 piece = from = matchEnd;
+             }
+             pieces.push_back({piece, end});
+         }
+         HandleScope scope(env);
+         LazyListBuilder builder(env);
+         for (auto& piece : pieces) {
+             builder.pushBack(substring(env, args[1].cast<String>(),
+                                        piece.first, piece.second));
+         }
+         return builder.result();
+     }},
+};
+
+extern "C" {
+void __dllMain(ebl::Environment& env)
+{
+    for (const auto& exp : exports) {
+        auto doc =
+            env.create<ebl::String>(exp.docstring_, strlen(exp.docstring_));
+        env.setGlobal(exp.name_, "regex",
+                      env.create<ebl::Function>(doc, exp.argc_, exp.impl_));
+    }
+}
+}
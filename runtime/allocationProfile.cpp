@@ -0,0 +1,65 @@
+#include "allocationProfile.hpp"
+#include "bytecode.hpp"
+#include "environment.hpp"
+
+namespace ebl {
+
+size_t AllocationProfile::nextSample()
+{
+    std::exponential_distribution<double> dist(1.0 / interval_);
+    return std::max(size_t(dist(rng_)), size_t(1));
+}
+
+static std::string firstLine(Heap::Ptr<String> str)
+{
+    auto text = str->toAscii();
+    return text.substr(0, text.find('\n'));
+}
+
+// A function's bytecode begins right after the instructions that push the
+// lambda, and jump over its body:
+// PUSHDOCUMENTEDLAMBDA(u8 argc, u16 docstring) JUMP(u16 offset)
+std::string AllocationProfile::describeFunction(Context& context,
+                                                const AllocationSite& site)
+{
+    const auto top = site.functionTop_;
+    if (top == 0) {
+        return "<top level>";
+    }
+    const auto& bc = context.getProgram();
+    const size_t jumpSize = 1 + sizeof(uint16_t);
+    const size_t pushSize = 2 + sizeof(uint16_t);
+    if (top >= jumpSize + pushSize and top <= bc.size() and
+        bc[top - jumpSize] == (uint8_t)Opcode::Jump and
+        bc[top - jumpSize - pushSize] ==
+            (uint8_t)Opcode::PushDocumentedLambda) {
+        const size_t docLoc = bc[top - jumpSize - 2] |
+                              (bc[top - jumpSize - 1] << 8);
+        auto& immediates = context.immediates();
+        if (docLoc < immediates.size() and
+            isType<String>(immediates[docLoc])) {
+            return firstLine(immediates[docLoc].cast<String>());
+        }
+    }
+    return "<lambda@" + std::to_string(top) + ">";
+}
+
+std::string AllocationProfile::describeNative(Context& context,
+                                              const AllocationSite& site)
+{
+    // Native functions are bound to globals by Environment::setGlobal(),
+    // which keeps them in the immediates.
+    for (auto& val : context.immediates()) {
+        if (isType<Function>(val)) {
+            auto fn = val.cast<Function>();
+            if (fn->getInvocationModel() == Function::Wrapped and
+                fn->nativeFunction() == site.native_ and
+                isType<String>(fn->getDocstring())) {
+                return firstLine(fn->getDocstring().cast<String>());
+            }
+        }
+    }
+    return "<native>";
+}
+
+} // namespace ebl
@@ -0,0 +1,84 @@
+#pragma once
+
+#include "types.hpp"
+#include "vm.hpp"
+#include <map>
+#include <random>
+#include <string>
+
+namespace ebl {
+
+class Context;
+
+// Where the mutator was when it allocated a value: running bytecode at ip_,
+// within the function beginning at functionTop_, and possibly within a call
+// from there to a native function.
+struct AllocationSite {
+    InstructionAddress ip_;
+    InstructionAddress functionTop_;
+    CFunction native_;
+    TypeId type_;
+
+    bool operator<(const AllocationSite& other) const
+    {
+        return std::tie(ip_, functionTop_, native_, type_) <
+               std::tie(other.ip_, other.functionTop_, other.native_,
+                        other.type_);
+    }
+};
+
+// AllocationProfile samples allocations, on average once every interval
+// bytes. The distance between samples is randomized, so that a loop that
+// allocates the same sequence of values on each iteration doesn't get all of
+// its samples attributed to one site. Each sample stands for roughly
+// interval bytes of allocation.
+class AllocationProfile {
+public:
+    AllocationProfile(size_t interval) : interval_(interval)
+    {
+        countdown_ = nextSample();
+    }
+
+    // Returns true when the allocation should be sampled.
+    bool allocated(size_t bytes)
+    {
+        if (LIKELY(bytes < countdown_)) {
+            countdown_ -= bytes;
+            return false;
+        }
+        countdown_ = nextSample();
+        return true;
+    }
+
+    void record(const AllocationSite& site)
+    {
+        ++samples_[site];
+    }
+
+    const std::map<AllocationSite, size_t>& samples() const
+    {
+        return samples_;
+    }
+
+    size_t interval() const
+    {
+        return interval_;
+    }
+
+    // Readable names for a site, from the docstrings of the enclosing lambda
+    // and of the native function, if any.
+    static std::string describeFunction(Context& context,
+                                        const AllocationSite& site);
+    static std::string describeNative(Context& context,
+                                      const AllocationSite& site);
+
+private:
+    size_t nextSample();
+
+    const size_t interval_;
+    size_t countdown_;
+    std::minstd_rand rng_;
+    std::map<AllocationSite, size_t> samples_;
+};
+
+} // namespace ebl
@@ -15,13 +15,19 @@ thread_local Vector<Lambda*> currentFunction;
 Scope::FindResult Scope::find(const Vector<StrVal>& varNamePatterns,
                               FrameDist traversed) const
 {
-    for (StackLoc i = 0; i < variables_.size(); ++i) {
-        for (auto& pattern : varNamePatterns) {
-            if (variables_[i].name_ == pattern) {
-                return {{traversed, i}, this, variables_[i].isMutable_};
-            }
+    // Of the variables matching a pattern, the one defined first wins.
+    auto first = index_.end();
+    for (auto& pattern : varNamePatterns) {
+        auto found = index_.find(pattern);
+        if (found not_eq index_.end() and
+            (first == index_.end() or found->second < first->second)) {
+            first = found;
         }
     }
+    if (first not_eq index_.end()) {
+        const StackLoc i = first->second;
+        return {{traversed, i}, this, variables_[i].isMutable_};
+    }
     if (parent_) {
         return parent_->find(varNamePatterns, traversed + 1);
     } else {
@@ -33,10 +39,10 @@ Scope::FindResult Scope::find(const Vector<StrVal>& varNamePatterns,
 Scope::FindResult Scope::find(const StrVal& varNamePath,
                               FrameDist traversed) const
 {
-    for (StackLoc i = 0; i < variables_.size(); ++i) {
-        if (variables_[i].name_ == varNamePath) {
-            return {{traversed, i}, this, variables_[i].isMutable_};
-        }
+    auto found = index_.find(varNamePath);
+    if (found not_eq index_.end()) {
+        const StackLoc i = found->second;
+        return {{traversed, i}, this, variables_[i].isMutable_};
     }
     if (parent_) {
         return parent_->find(varNamePath, traversed + 1);
@@ -178,6 +184,7 @@ void Symbol::init(Environment& env, Scope& scope)
 
 void List::init(Environment& env, Scope& scope)
 {
+    HandleScope handleScope(env);
     LazyListBuilder builder(env);
     for (auto& element : contents_) {
         element->init(env, scope);
@@ -6,6 +6,7 @@
 #include <limits>
 #include <memory>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
 namespace ebl {
@@ -40,11 +41,9 @@ public:
             throw std::runtime_error("Too many variables in environment");
         }
         const StackLoc ret = variables_.size();
-        for (const auto& var : variables_) {
-            if (var.name_ == varName) {
-                throw Error("redefinition of variable " + varName +
-                            " not allowed");
-            }
+        if (not index_.emplace(varName, ret).second) {
+            throw Error("redefinition of variable " + varName +
+                        " not allowed");
         }
         variables_.push_back({varName, isMutable});
         return ret;
@@ -70,6 +69,8 @@ public:
 private:
     Scope* parent_ = nullptr;
     Vector<Variable> variables_;
+    // Each variable's position in variables_, by name.
+    std::unordered_map<StrVal, StackLoc> index_;
 };
 
 
@@ -1,12 +1,17 @@
 #include <algorithm>
+#include <cstdio>
+#include <cstring>
 #include <fstream>
 #include <functional>
+#include <limits>
 #include <ostream>
 #include <string>
 #include <vector>
 
 #include "lexer.hpp"
 #include "ebl.hpp"
+#include "format.hpp"
+#include "numbers.hpp"
 #include "listBuilder.hpp"
 
 namespace ebl {
@@ -15,9 +20,9 @@ template <typename Proc> void dolist(Environment& env,
                                      ValuePtr list,
                                      Proc&& proc)
 {
-    Persistent<Pair> current(env, checkedCast<Pair>(list));
-    Persistent<Value> car(env, env.getNull());
-    car = current->getCar();
+    HandleScope scope(env);
+    Handle<Pair> current(env, checkedCast<Pair>(list));
+    Handle<Value> car(env, current->getCar());
     proc(car);
     while (not isType<Null>(current->getCdr())) {
         current = checkedCast<Pair>(current->getCdr());
@@ -46,26 +51,25 @@ void failedToApply(Environment& env,
     throw std::runtime_error(format.str());
 }
 
-void print(Environment& env, ValuePtr val, std::ostream& out,
-           bool showQuotes = false)
+void print(Environment& env, ValuePtr val, std::string& out, bool showQuotes)
 {
     switch (val->typeId()) {
     case typeId<Pair>(): {
         auto pair = val.cast<Pair>();
-        out << "(";
+        out += '(';
         print(env, pair->getCar(), out, true);
         if (not isType<Pair>(pair->getCdr())) {
-            out << " . ";
+            out += " . ";
             print(env, pair->getCdr(), out, true);
         } else {
             while (true) {
                 if (isType<Pair>(pair->getCdr())) {
-                    out << " ";
+                    out += ' ';
                     print(env, pair->getCdr().cast<Pair>()->getCar(), out,
                           true);
                     pair = pair->getCdr().cast<Pair>();
                 } else if (not isType<Null>(pair->getCdr())) {
-                    out << " ";
+                    out += ' ';
                     print(env, pair->getCdr(), out, true);
                     break;
                 } else {
@@ -73,65 +77,164 @@ void print(Environment& env, ValuePtr val, std::ostream& out,
                 }
             }
         }
-        out << ")";
+        out += ')';
     } break;
 
     case typeId<Box>():
-        out << "Box{";
-        print(env, val.cast<Box>()->get(), out);
-        out << "}";
+        out += "Box{";
+        print(env, val.cast<Box>()->get(), out, false);
+        out += '}';
         break;
 
     case typeId<Integer>():
-        out << val.cast<Integer>()->value();
+        formatInteger(out, val.cast<Integer>()->value());
         break;
 
     case typeId<Null>():
-        out << "null";
+        out += "null";
         break;
 
     case typeId<Boolean>():
-        out << ((val == env.getBool(true)) ? "true" : "false");
+        out += (val == env.getBool(true)) ? "true" : "false";
         break;
 
     case typeId<Function>():
-        out << "lambda<" << val.cast<Function>()->argCount() << ">";
+        out += "lambda<";
+        formatInteger(out, val.cast<Function>()->argCount());
+        out += '>';
         break;
 
-    case typeId<String>():
+    case typeId<String>(): {
+        auto str = val.cast<String>();
         if (showQuotes) {
-            out << '"' << *val.cast<String>() << '"';
-        } else {
-            out << *val.cast<String>();
+            out += '"';
         }
-        break;
+        out.append(str->data(), str->bytes());
+        if (showQuotes) {
+            out += '"';
+        }
+    } break;
 
     case typeId<Float>():
-        out << val.cast<Float>()->value();
+        formatFloat(out, val.cast<Float>()->value());
         break;
 
-    case typeId<Complex>():
-        out << val.cast<Complex>()->value();
-        break;
+    case typeId<Complex>(): {
+        const auto value = val.cast<Complex>()->value();
+        out += '(';
+        formatFloat(out, value.real());
+        out += ',';
+        formatFloat(out, value.imag());
+        out += ')';
+    } break;
 
     case typeId<Symbol>(): {
-        out << *val.cast<Symbol>()->value();
+        const auto& name = *val.cast<Symbol>()->value();
+        out.append(name.data(), name.bytes());
     } break;
 
-    case typeId<RawPointer>():
-        out << val.cast<RawPointer>()->value();
-        break;
+    case typeId<RawPointer>(): {
+        // As an ostream prints a void pointer.
+        const auto address = (uintptr_t)val.cast<RawPointer>()->value();
+        if (address == 0) {
+            out += '0';
+            break;
+        }
+        char digits[2 * sizeof address + 2];
+        const int length = snprintf(digits, sizeof digits, "0x%llx",
+                                    (unsigned long long)address);
+        out.append(digits, length);
+    } break;
 
     case typeId<Character>():
-        out << *val.cast<Character>();
+        for (char c : val.cast<Character>()->value()) {
+            if (c == 0) {
+                break;
+            }
+            out += c;
+        }
+        break;
+
+    case typeId<StringBuilder>():
+        if (showQuotes) {
+            out += '"';
+        }
+        val.cast<StringBuilder>()->appendTo(out);
+        if (showQuotes) {
+            out += '"';
+        }
         break;
 
     default:
-        out << "unknownValue";
+        out += "unknownValue";
         break;
     }
 }
 
+void print(Environment& env, ValuePtr val, std::ostream& out, bool showQuotes)
+{
+    std::string text;
+    print(env, val, text, showQuotes);
+    out.write(text.data(), text.size());
+}
+
+// A String of the bytes from first up to last in str. Slicing an ASCII
+// string can't split a glyph, and a binary string's slices should stay
+// binary.
+static ValuePtr substring(Environment& env, Heap::Ptr<String> str,
+                          size_t first, size_t last)
+{
+    return env.create<String>(str->data() + first, last - first,
+                              str->ascii() ? String::Encoding::binary
+                                           : String::Encoding::utf8);
+}
+
+// The UTF-8 bytes of a String or Character, for searching within a String.
+static std::string searchText(ValuePtr val)
+{
+    switch (val->typeId()) {
+    case typeId<String>(): {
+        auto str = val.cast<String>();
+        return std::string(str->data(), str->bytes());
+    }
+    case typeId<Character>(): {
+        const auto& glyph = val.cast<Character>()->value();
+        return std::string(glyph.data(),
+                           std::max(utf8GlyphSize(glyph[0]), size_t(1)));
+    }
+    default:
+        throw TypeError(val->typeId(), "expected a string or character");
+    }
+}
+
+// Returns the first occurrence of pattern in [begin, end), or end. memchr
+// skips ahead to each candidate first byte, and it's vectorized by the C
+// library, so the scan doesn't go byte by byte.
+static const char* search(const char* begin, const char* end,
+                          const std::string& pattern)
+{
+    if (pattern.empty()) {
+        return begin;
+    }
+    while (size_t(end - begin) >= pattern.size()) {
+        auto found = (const char*)memchr(begin, pattern[0], end - begin);
+        if (not found or size_t(end - found) < pattern.size()) {
+            break;
+        }
+        if (memcmp(found + 1, pattern.data() + 1, pattern.size() - 1) == 0) {
+            return found;
+        }
+        begin = found + 1;
+    }
+    return end;
+}
+
+static bool isSpace(char c)
+{
+    return c == ' ' or c == '\t' or c == '\n' or c == '\r' or c == '\v' or
+           c == '\f';
+}
+
 struct BuiltinFunctionInfo {
     const char* name;
     const char* docstring;
@@ -157,8 +260,10 @@ static const BuiltinFunctionInfo builtins[] =
           return env.create<Box>(args[0]);
       }},
      {"set-box!", "(set-box! box value) -> box with overwritten contents", 2,
-      [](Environment&, const Arguments& args) -> ValuePtr {
-          checkedCast<Box>(args[0])->set(args[1]);
+      [](Environment& env, const Arguments& args) -> ValuePtr {
+          auto box = checkedCast<Box>(args[0]);
+          env.getContext()->writeBarrier(box, args[1]);
+          box->set(args[1]);
           return args[0];
       }},
      {"unbox", "(unbox box) -> value stored in box", 1,
@@ -167,16 +272,14 @@ static const BuiltinFunctionInfo builtins[] =
       }},
      {"symbol", "(symbol string) -> get symbol for string", 1,
       [](Environment& env, const Arguments& args) -> ValuePtr {
-          const auto target = checkedCast<String>(args[0]);
-          const auto symbLoc = storeI<Symbol>(*env.getContext(), target);
-          return env.getContext()->immediates()[symbLoc];
+          return env.getContext()->intern(checkedCast<String>(args[0]));
       }},
      {"error", "(error string) -> raise error string and terminate", 1,
       [](Environment&, const Arguments& args) -> ValuePtr {
           throw std::runtime_error(
               checkedCast<String>(args[0])->value().toAscii());
       }},
-     {"length", "(length val) -> get the length of a list or string", 1,
+     {"length", "(length val) -> get the length of a list, string or builder", 1,
       [](Environment& env, const Arguments& args) -> ValuePtr {
           switch (args[0]->typeId()) {
           case typeId<Pair>(): {
@@ -189,17 +292,20 @@ static const BuiltinFunctionInfo builtins[] =
           case typeId<String>():
               return env.create<Integer>(
                   (Integer::Rep)args[0].cast<String>()->value().length());
+          case typeId<StringBuilder>():
+              return env.create<Integer>(
+                  (Integer::Rep)args[0].cast<StringBuilder>()->length());
           default:
               throw TypeError(args[0]->typeId(), "invalid type");
           }
       }},
      {"get", "(get val index) -> get element at index in list or string", 2,
-      [](Environment&, const Arguments& args) -> ValuePtr {
+      [](Environment& env, const Arguments& args) -> ValuePtr {
           switch (args[0]->typeId()) {
-          case typeId<String>():
-              return (
-                  *args[0]
-                       .cast<String>())[checkedCast<Integer>(args[1])->value()];
+          case typeId<String>(): {
+              const auto index = checkedCast<Integer>(args[1])->value();
+              return env.getCharacter((*args[0].cast<String>())[index]);
+          }
 
           case typeId<Pair>():
               return listRef(args[0].cast<Pair>(),
@@ -510,19 +616,87 @@ static const BuiltinFunctionInfo builtins[] =
       }},
      {"string", "(string ...) -> string constructed from all the args", 0,
       [](Environment& env, const Arguments& args) -> ValuePtr {
-          std::stringstream builder;
+          std::string text;
           for (auto& arg : args) {
-              print(env, arg, builder);
+              print(env, arg, text, false);
           }
-          return env.create<String>(builder.str());
+          return env.create<String>(text);
       }},
      {"rstring", "(rstring ...) -> string constructed from args in reverse", 0,
       [](Environment& env, const Arguments& args) -> ValuePtr {
-          std::stringstream builder;
+          std::string text;
           for (long i = args.count() - 1; i > -1; --i) {
-              print(env, args[i], builder);
+              print(env, args[i], text, false);
+          }
+          return env.create<String>(text);
+      }},
+     {"format",
+      "(format template ...) -> string of template, with each {} replaced "
+      "by the next arg",
+      1,
+      [](Environment& env, const Arguments& args) -> ValuePtr {
+          auto text = checkedCast<String>(args[0]);
+          std::string result;
+          compileFormat(text->data(), text->bytes())
+              .render(env, args, 1, result);
+          return env.create<String>(result);
+      }},
+     {"string-builder",
+      "(string-builder ...) -> builder holding the args, (string builder) "
+      "to flatten it",
+      0,
+      [](Environment& env, const Arguments& args) -> ValuePtr {
+          std::string text;
+          for (auto& arg : args) {
+              print(env, arg, text, false);
+          }
+          return env.create<StringBuilder>(text);
+      }},
+     {"append!", "(append! builder ...) -> builder, with the args appended", 1,
+      [](Environment& env, const Arguments& args) -> ValuePtr {
+          auto builder = checkedCast<StringBuilder>(args[0]);
+          std::string text;
+          for (size_t i = 1; i < args.count(); ++i) {
+              print(env, args[i], text, false);
+          }
+          builder->append(text);
+          return builder;
+      }},
+     {"prepend!", "(prepend! builder ...) -> builder, with the args prepended",
+      1,
+      [](Environment& env, const Arguments& args) -> ValuePtr {
+          auto builder = checkedCast<StringBuilder>(args[0]);
+          std::string text;
+          for (size_t i = 1; i < args.count(); ++i) {
+              print(env, args[i], text, false);
+          }
+          builder->prepend(text);
+          return builder;
+      }},
+     {"slice",
+      "(slice str begin end) -> string of the glyphs from begin up to end, "
+      "in a string or builder",
+      3,
+      [](Environment& env, const Arguments& args) -> ValuePtr {
+          const auto begin = checkedCast<Integer>(args[1])->value();
+          const auto end = checkedCast<Integer>(args[2])->value();
+          switch (args[0]->typeId()) {
+          case typeId<String>(): {
+              auto str = args[0].cast<String>();
+              if (begin < 0 or begin > end or size_t(end) > str->length()) {
+                  throw std::runtime_error("invalid slice of String");
+              }
+              return substring(env, str, str->offset(begin), str->offset(end));
+          }
+          case typeId<StringBuilder>():
+              if (begin < 0) {
+                  throw std::runtime_error("invalid slice of StringBuilder");
+              }
+              return env.create<String>(
+                  args[0].cast<StringBuilder>()->slice(begin, end));
+          default:
+              throw TypeError(args[0]->typeId(), "invalid type");
           }
-          return env.create<String>(builder.str());
       }},
      {"integer", "(integer val) -> integer conversion of the input", 1,
       [](Environment& env, const Arguments& args) -> ValuePtr {
@@ -530,8 +704,15 @@ static const BuiltinFunctionInfo builtins[] =
           case typeId<Integer>():
               return args[0];
           case typeId<String>(): {
-              Integer::Rep i = std::stoi(args[0].cast<String>()->toAscii());
-              return env.create<Integer>(i);
+              auto str = args[0].cast<String>();
+              long long value;
+              if (parseInteger(str->data(), str->data() + str->bytes(),
+                               value) == str->data() or
+                  value < std::numeric_limits<Integer::Rep>::min() or
+                  value > std::numeric_limits<Integer::Rep>::max()) {
+                  throw ConversionError(typeId<String>(), typeId<Integer>());
+              }
+              return env.create<Integer>(Integer::Rep(value));
           }
           case typeId<Float>():
               return env.create<Integer>(
@@ -550,8 +731,13 @@ static const BuiltinFunctionInfo builtins[] =
           case typeId<Float>():
               return args[0];
           case typeId<String>(): {
-              Float::Rep d = std::stod(args[0].cast<String>()->toAscii());
-              return env.create<Float>(d);
+              auto str = args[0].cast<String>();
+              Float::Rep value;
+              if (parseFloat(str->data(), str->data() + str->bytes(),
+                             value) == str->data()) {
+                  throw ConversionError(typeId<String>(), typeId<Float>());
+              }
+              return env.create<Float>(value);
           }
           case typeId<Integer>():
               return env.create<Float>(
@@ -564,8 +750,7 @@ static const BuiltinFunctionInfo builtins[] =
       [](Environment& env, const Arguments& args) -> ValuePtr {
           const auto val = checkedCast<Integer>(args[0])->value();
           if (val > -127 and val < 127) {
-              return env.create<Character>(
-                  Character::Rep{{(char)val, 0, 0, 0}});
+              return env.getCharacter(Character::Rep{{(char)val, 0, 0, 0}});
           }
           return env.getNull();
       }},
@@ -582,15 +767,15 @@ static const BuiltinFunctionInfo builtins[] =
       }},
      {"eval", "(eval data) -> evaluate data as code", 1,
       [](Environment& env, const Arguments& args) {
-          std::stringstream buffer;
-          print(env, checkedCast<Pair>(args[0]), buffer);
-          return env.exec(buffer.str());
+          std::string buffer;
+          print(env, checkedCast<Pair>(args[0]), buffer, false);
+          return env.exec(buffer);
       }},
      {"eval-string", "(eval-string string) -> evaluate string as code", 1,
       [](Environment& env, const Arguments& args) {
-          std::stringstream buffer;
+          std::string buffer;
           print(env, checkedCast<String>(args[0]), buffer, false);
-          return env.exec(buffer.str());
+          return env.exec(buffer);
       }},
      {"open-dll", "(open-dll dll-path) -> run dll in current environment", 1,
       [](Environment& env, const Arguments& args) {
@@ -614,6 +799,151 @@ static const BuiltinFunctionInfo builtins[] =
           return env.create<Object>();
       }}};
 
+// String algorithms, in the std namespace, see std/str.ebl. These work on a
+// String's bytes directly, rather than a glyph at a time.
+static const BuiltinFunctionInfo stringBuiltins[] = {
+    {"substr", "(substr str begin end) -> substring from (begin, end)", 3,
+     [](Environment& env, const Arguments& args) -> ValuePtr {
+         auto str = checkedCast<String>(args[0]);
+         const auto begin = checkedCast<Integer>(args[1])->value();
+         const auto end = checkedCast<Integer>(args[2])->value();
+         if (begin < 0 or begin > end or size_t(end) > str->length()) {
+             throw std::runtime_error("invalid index to substr");
+         }
+         return substring(env, str, str->offset(begin), str->offset(end));
+     }},
+    {"split",
+     "(split str delim) -> list of substrings, by cleaving str at delim", 2,
+     [](Environment& env, const Arguments& args) -> ValuePtr {
+         auto str = checkedCast<String>(args[0]);
+         const auto delim = searchText(args[1]);
+         if (delim.empty()) {
+             throw std::runtime_error("empty delimiter passed to split");
+         }
+         HandleScope scope(env);
+         LazyListBuilder builder(env);
+         // The text lives outside of the heap, so it stays put while the
+         // substrings are allocated.
+         const char* const data = str->data();
+         const char* const end = data + str->bytes();
+         const char* piece = data;
+         while (true) {
+             const char* found = search(piece, end, delim);
+             // A leading empty substring is left out, so splitting an empty
+             // string results in an empty list.
+             if (found not_eq data) {
+                 builder.pushBack(substring(env, args[0].cast<String>(),
+                                            piece - data, found - data));
+             }
+             if (found == end) {
+                 break;
+             }
+             piece = found + delim.size();
+         }
+         return builder.result();
+     }},
+    {"find",
+     "(find str pattern [start]) -> index of the first pattern at or after "
+     "start, or false",
+     2,
+     [](Environment& env, const Arguments& args) -> ValuePtr {
+         auto str = checkedCast<String>(args[0]);
+         const auto pattern = searchText(args[1]);
+         size_t start = 0;
+         if (args.count() > 2) {
+             const auto index = checkedCast<Integer>(args[2])->value();
+             if (index < 0 or size_t(index) > str->length()) {
+                 throw std::runtime_error("invalid index to find");
+             }
+             start = str->offset(index);
+         }
+         const char* const end = str->data() + str->bytes();
+         const char* found = search(str->data() + start, end, pattern);
+         if (found == end and not pattern.empty()) {
+             return env.getBool(false);
+         }
+         return env.create<Integer>(
+             (Integer::Rep)str->glyphAt(found - str->data()));
+     }},
+    {"replace",
+     "(replace str pattern replacement) -> str, with each pattern replaced",
+     3,
+     [](Environment& env, const Arguments& args) -> ValuePtr {
+         auto str = checkedCast<String>(args[0]);
+         const auto pattern = searchText(args[1]);
+         const auto replacement = searchText(args[2]);
+         if (pattern.empty()) {
+             throw std::runtime_error("empty pattern passed to replace");
+         }
+         std::string result;
+         const char* current = str->data();
+         const char* const end = current + str->bytes();
+         while (true) {
+             const char* found = search(current, end, pattern);
+             result.append(current, found);
+             if (found == end) {
+                 break;
+             }
+             result += replacement;
+             current = found + pattern.size();
+         }
+         const bool ascii =
+             str->ascii() and
+             std::none_of(replacement.begin(), replacement.end(),
+                          [](char c) { return c & 0x80; });
+         return env.create<String>(result, ascii ? String::Encoding::binary
+                                                 : String::Encoding::utf8);
+     }},
+    {"starts-with?",
+     "(starts-with? str prefix) -> whether str begins with prefix", 2,
+     [](Environment& env, const Arguments& args) -> ValuePtr {
+         auto str = checkedCast<String>(args[0]);
+         const auto prefix = searchText(args[1]);
+         return env.getBool(str->bytes() >= prefix.size() and
+                            memcmp(str->data(), prefix.data(),
+                                   prefix.size()) == 0);
+     }},
+    {"trim", "(trim str) -> str, without leading or trailing whitespace", 1,
+     [](Environment& env, const Arguments& args) -> ValuePtr {
+         auto str = checkedCast<String>(args[0]);
+         size_t first = 0;
+         size_t last = str->bytes();
+         while (first < last and isSpace(str->data()[first])) {
+             ++first;
+         }
+         while (last > first and isSpace(str->data()[last - 1])) {
+             --last;
+         }
+         if (first == 0 and last == str->bytes()) {
+             return str;
+         }
+         return substring(env, str, first, last);
+     }},
+    {"parse-float",
+     "(parse-float str index) -> (float . index just past it), for the "
+     "number written at index in str, or false",
+     2,
+     [](Environment& env, const Arguments& args) -> ValuePtr {
+         auto str = checkedCast<String>(args[0]);
+         const auto index = checkedCast<Integer>(args[1])->value();
+         if (index < 0 or size_t(index) > str->length()) {
+             throw std::runtime_error("invalid index to parse-float");
+         }
+         const char* const begin = str->data() + str->offset(index);
+         Float::Rep value;
+         const char* const end =
+             parseFloat(begin, str->data() + str->bytes(), value);
+         if (end == begin) {
+             return env.getBool(false);
+         }
+         HandleScope scope(env);
+         Handle<Float> number(env, env.create<Float>(value));
+         // A number is written in ASCII, so it's as many glyphs as bytes.
+         Handle<Integer> next(
+             env, env.create<Integer>(Integer::Rep(index + (end - begin))));
+         return env.create<Pair>(number.slot(), next.slot());
+     }}};
+
 void initBuiltins(Environment& env)
 {
     std::for_each(
@@ -627,6 +957,11 @@ void initBuiltins(Environment& env)
             auto fn = env.create<Function>(doc, info.requiredArgs, info.impl);
             env.setGlobal(info.name, fn);
         });
+    for (auto& info : stringBuiltins) {
+        auto doc = env.create<String>(info.docstring, strlen(info.docstring));
+        env.setGlobal(info.name, "std",
+                      env.create<Function>(doc, info.requiredArgs, info.impl));
+    }
 }
 
 } // namespace ebl
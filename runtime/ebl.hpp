@@ -6,6 +6,9 @@ namespace ebl {
 
 void print(Environment& env, ValuePtr val, std::ostream& out, bool showQuotes);
 
+// Appends the printed form of val to out.
+void print(Environment& env, ValuePtr val, std::string& out, bool showQuotes);
+
 inline ValuePtr listRef(Heap::Ptr<Pair> p, size_t index)
 {
     while (index > 0) {
@@ -71,8 +71,15 @@ void Environment::setGlobal(const std::string& key, ValuePtr value)
     context_->callStack().pop_back();
 }
 
+Environment::Environment(Context* context, EnvPtr parent)
+    : context_(context), parent_(parent),
+      regionSerial_(context->region_.serial())
+{
+}
+
 void Environment::push(ValuePtr value)
 {
+    context_->writeBarrier(*this, value);
     vars_.push_back(value);
 }
 
@@ -100,7 +107,9 @@ ValuePtr Environment::load(VarLoc loc)
 
 void Environment::store(VarLoc loc, ValuePtr value)
 {
-    getFrame(loc).vars_[loc.offset_] = value;
+    auto& frame = getFrame(loc);
+    context_->writeBarrier(frame, value);
+    frame.vars_[loc.offset_] = value;
 }
 
 ValuePtr Environment::getNull()
@@ -113,6 +122,15 @@ ValuePtr Environment::getBool(bool trueOrFalse)
     return context_->booleans_[trueOrFalse];
 }
 
+Heap::Ptr<Character> Environment::getCharacter(const Character::Rep& glyph)
+{
+    const auto lead = (unsigned char)glyph[0];
+    if (lead < context_->asciiCharacters_.size() and glyph[1] == 0) {
+        return context_->asciiCharacters_[lead];
+    }
+    return create<Character>(glyph);
+}
+
 EnvPtr Environment::derive()
 {
     PoolAllocator<Environment> alloc;
@@ -135,30 +153,201 @@ void initBuiltins(Environment& env);
 const Context::Configuration& Context::defaultConfig()
 {
     static const Configuration defaults{
-        10000000 // Ten megabyte heap
+        10000000, // Ten megabyte heap
+        0,        // Stop-the-world collection
+        0,
+        1,        // Collect on the allocating thread
+        1 << 16,  // Handles
+        Configuration::HeapLayout::contiguous,
+        0,
+        0,        // No allocation profiling
+        1 << 20,  // Release free heap tails of a megabyte or more
+        false,
+        0         // Regions the size of the heap
     };
     return defaults;
 }
 
 #include "onloads.hpp"
 
+static PageSpace* makePageSpace(const Context::Configuration& config)
+{
+    using Layout = Context::Configuration::HeapLayout;
+    if (config.heapLayout_ == Layout::segregated) {
+        return new PageSpace(config.pageSpaceSize_ ? config.pageSpaceSize_
+                                                   : config.heapSize_);
+    }
+    return nullptr;
+}
+
+static GC* makeCollector(const Context::Configuration& config,
+                         const Heap& heap, PageSpace* pages, Region* region)
+{
+    if (config.gcSliceBudget_ or config.gcSliceTimeBudget_) {
+        return new IncrementalMarkCompact(
+            heap, pages, region, config.gcThreads_, config.gcSliceBudget_,
+            std::chrono::microseconds(config.gcSliceTimeBudget_));
+    }
+    return new MarkCompact(heap, pages, region, config.gcThreads_);
+}
+
 Context::Context(const Configuration& config)
-    : heap_(config.heapSize_, 0),
+    : heap_(config.heapSize_, Heap::Mapped{config.heapHugePages_}),
+      heapHighWater_(heap_.begin()),
+      heapReleaseThreshold_(config.heapReleaseThreshold_
+                                ? config.heapReleaseThreshold_
+                                : defaultConfig().heapReleaseThreshold_),
+      pages_(makePageSpace(config)),
+      region_(config.regionSize_ ? config.regionSize_ : config.heapSize_),
+      collector_{makeCollector(config, heap_, pages_.get(), &region_)},
+      incremental_(dynamic_cast<IncrementalMarkCompact*>(collector_.get())),
       topLevel_(std::allocate_shared<Environment>(PoolAllocator<Environment>{},
                                                   this, nullptr)),
       booleans_{{topLevel_->create<Boolean>(false)},
                 {topLevel_->create<Boolean>(true)}},
-      nullValue_{topLevel_->create<Null>()}, collector_{new MarkCompact},
+      nullValue_{topLevel_->create<Null>()},
+      handles_(config.handleStackSize_ ? config.handleStackSize_
+                                        : defaultConfig().handleStackSize_),
       persistentsList_(nullptr)
 {
+    // Shared, like the booleans and null, and likewise kept alive and
+    // remapped by the collector, see Context::forEachConstant().
+    for (int c = 0; c < 128; ++c) {
+        asciiCharacters_.push_back(
+            topLevel_->create<Character>(Character::Rep{{(char)c, 0, 0, 0}}));
+    }
     topLevel_->exec("");
     initBuiltins(*topLevel_);
     callStack_.push_back({0, 0, topLevel_});
     topLevel_->exec(onloads);
+    profileAllocations(config.allocationSampleInterval_);
+}
+
+void Context::collected(uint8_t* top)
+{
+    heapHighWater_ = std::max(heapHighWater_, top);
+    if (size_t(heapHighWater_ - heap_.end()) >= heapReleaseThreshold_) {
+        heap_.release(heapHighWater_);
+        heapHighWater_ = heap_.end();
+    }
+}
+
+Context::InternedSymbol& Context::internEntry(Heap::Ptr<String> str)
+{
+    std::string name(str->data(), str->bytes());
+    auto found = symbols_.find(name);
+    if (found not_eq symbols_.end()) {
+        // The table is weak, so a symbol that the incremental collector
+        // hasn't reached yet needs to be shaded before it's handed out.
+        writeBarrier(found->second.symbol_);
+        return found->second;
+    }
+    HandleScope scope(*topLevel_);
+    Handle<String> handle(*topLevel_, str);
+    auto symbol = topLevel_->create<Symbol>(str);
+    str = handle;
+    writeBarrier(symbol, str);
+    symbol->set(str);
+    return symbols_
+        .emplace(std::move(name), InternedSymbol{symbol, noImmediate})
+        .first->second;
+}
+
+Heap::Ptr<Symbol> Context::intern(Heap::Ptr<String> str)
+{
+    return internEntry(str).symbol_.cast<Symbol>();
+}
+
+ImmediateId Context::internImmediate(Heap::Ptr<String> str)
+{
+    auto& entry = internEntry(str);
+    if (entry.immediate_ == noImmediate) {
+        entry.immediate_ = immediates_.size();
+        immediates_.push_back(entry.symbol_);
+    }
+    return entry.immediate_;
+}
+
+void Context::profileAllocations(size_t interval)
+{
+    if (interval) {
+        allocationProfile_.reset(new AllocationProfile(interval));
+    } else {
+        allocationProfile_.reset();
+    }
+}
+
+void Context::sampleAllocation(TypeId type)
+{
+    AllocationSite site{0, 0, executionSite_.native_, type};
+    if (executionSite_.ip_) {
+        site.ip_ = *executionSite_.ip_;
+    }
+    // Let expressions push frames without a function address.
+    for (auto frame = callStack_.rbegin(); frame not_eq callStack_.rend();
+         ++frame) {
+        if (frame->functionTop_) {
+            site.functionTop_ = frame->functionTop_;
+            break;
+        }
+    }
+    allocationProfile_->record(site);
+}
+
+void Context::openRegion()
+{
+    if (region_.isOpen()) {
+        throw std::runtime_error("a region is already open");
+    }
+    region_.open();
+    regionAllocated_ = 0;
+    regionPromoted_ = 0;
+}
+
+size_t Context::evacuateRegion()
+{
+    const size_t promoted = collector_->evacuate(*topLevel_, heap_);
+    if (incremental_) {
+        // Values moved into the heap during a marking cycle are treated as
+        // new allocations.
+        uint8_t* cell = heap_.end() - promoted;
+        while (cell < heap_.end()) {
+            auto val = Heap::wrap(cell).cast<Value>();
+            cell += valueSize(val);
+            incremental_->allocated(val);
+        }
+    }
+    return promoted;
+}
+
+void Context::recycleRegion()
+{
+    regionAllocated_ += region_.arena().size();
+    regionPromoted_ += evacuateRegion();
+    region_.reset();
+}
+
+Context::RegionStat Context::closeRegion()
+{
+    if (not region_.isOpen()) {
+        throw std::runtime_error("no region is open");
+    }
+    const size_t allocated = regionAllocated_ + region_.arena().size();
+    const size_t promoted = regionPromoted_ + evacuateRegion();
+    region_.close(heapReleaseThreshold_);
+    return {allocated, promoted};
 }
 
 Context::~Context()
 {
+    if (region_.isOpen()) {
+        for (auto& val : region_.finalizable()) {
+            typeInfo(val).finalizer(val.get());
+        }
+    }
+    for (auto& val : finalizable_) {
+        typeInfo(val).finalizer(val.get());
+    }
 }
 
 void Context::writeToFile(const std::string& fname)
@@ -227,11 +416,6 @@ void Context::loadFromFile(const std::string& fname)
     }
 }
 
-Context* Environment::getContext()
-{
-    return context_;
-}
-
 ValuePtr Environment::exec(const std::string& code)
 {
     auto root = ebl::parse(code);
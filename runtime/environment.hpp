@@ -7,6 +7,7 @@
 #include <new>
 #include <string>
 #include <tuple>
+#include <unordered_map>
 #include <vector>
 
 #include "common.hpp"
@@ -15,7 +16,9 @@
 // FIXME!!!
 #include "../extlib/smallVector.hpp"
 
+#include "allocationProfile.hpp"
 #include "gc.hpp"
+#include "handle.hpp"
 #include "memory.hpp"
 #include "types.hpp"
 #include "vm.hpp"
@@ -30,14 +33,14 @@ using EnvPtr = std::shared_ptr<Environment>;
 
 class Environment : public std::enable_shared_from_this<Environment> {
 public:
-    Environment(Context* context, EnvPtr parent)
-        : context_(context), parent_(parent)
-    {
-    }
+    Environment(Context* context, EnvPtr parent);
     Environment(const Environment&) = delete;
 
     template <typename T, typename... Args> Heap::Ptr<T> create(Args&&... args);
 
+    // See Context::createList().
+    template <typename F> ValuePtr createList(size_t count, F&& element);
+
     // Load/store a variable in the root environment.
     ValuePtr getGlobal(const std::string& key);
     void setGlobal(const std::string& key, ValuePtr value);
@@ -50,6 +53,10 @@ public:
     ValuePtr getNull();
     ValuePtr getBool(bool trueOrFalse);
 
+    // ASCII characters are preallocated by the Context and shared, so only
+    // other glyphs allocate a new Character.
+    Heap::Ptr<Character> getCharacter(const Character::Rep& glyph);
+
     // For storing and loading from an environment's stack. Only meant to be
     // called by the runtime or the vm.
     void push(ValuePtr value);
@@ -63,7 +70,10 @@ public:
     EnvPtr parent();
     EnvPtr reference();
 
-    Context* getContext();
+    Context* getContext()
+    {
+        return context_;
+    }
 
     using Variables = Ogre::SmallVector<ValuePtr, 6>;
     Variables& getVars()
@@ -71,12 +81,35 @@ public:
         return vars_;
     }
 
+    // Used by the collector to visit each frame once per trace. Returns
+    // false if the frame was already visited during the current epoch. Safe
+    // to call from several collector threads at once.
+    bool gcVisit(size_t epoch)
+    {
+        return __atomic_exchange_n(&gcEpoch_, epoch, __ATOMIC_RELAXED) not_eq
+               epoch;
+    }
+
+    // Used by the write barrier to remember each frame that predates an
+    // open region once. Returns false if the frame was created during the
+    // region with the given serial number, or was already remembered by it.
+    bool regionVisit(size_t serial)
+    {
+        if (regionSerial_ == serial) {
+            return false;
+        }
+        regionSerial_ = serial;
+        return true;
+    }
+
 private:
     Environment& getFrame(VarLoc loc);
 
     Context* context_;
     EnvPtr parent_;
     Variables vars_;
+    size_t gcEpoch_ = 0;
+    size_t regionSerial_;
 };
 
 template <typename T> struct ConstructImpl {
@@ -107,8 +140,49 @@ class Context {
 public:
     struct Configuration {
         size_t heapSize_;
+
+        // When either budget is nonzero, the collector marks incrementally,
+        // in slices of at most gcSliceBudget_ traced values, or of at most
+        // gcSliceTimeBudget_ microseconds, interleaved with allocation.
+        size_t gcSliceBudget_;
+        size_t gcSliceTimeBudget_;
+
+        // Number of threads that mark and compact in parallel during a
+        // pause. Zero or one collects on the allocating thread alone.
+        size_t gcThreads_;
+
+        // Capacity of the handle stack, in handles. Zero selects the
+        // default.
+        size_t handleStackSize_;
+
+        // With the segregated layout, Pairs and other small values that
+        // don't need finalizing are allocated from a separate, non-moving
+        // space of size class pages (see PageSpace), of pageSpaceSize_
+        // bytes, and everything else goes in the compacted heap. A zero
+        // pageSpaceSize_ selects heapSize_.
+        enum class HeapLayout { contiguous, segregated };
+        HeapLayout heapLayout_;
+        size_t pageSpaceSize_;
+
+        // When nonzero, allocations are sampled, about once every
+        // allocationSampleInterval_ bytes, see profileAllocations().
+        size_t allocationSampleInterval_;
+
+        // The heap is mapped on demand, and after a collection, once at
+        // least heapReleaseThreshold_ bytes above the compacted heap are no
+        // longer in use, they're returned to the operating system. Zero
+        // selects the default. heapHugePages_ asks for transparent huge
+        // pages, for large heaps.
+        size_t heapReleaseThreshold_;
+        bool heapHugePages_;
+
+        // Capacity of the arena backing regions, see openRegion(). Zero
+        // selects heapSize_.
+        size_t regionSize_;
     };
 
+    static const Configuration& defaultConfig();
+
     Context(const Configuration& config = defaultConfig());
     Context(const Context&) = delete;
     ~Context();
@@ -118,6 +192,55 @@ public:
         return immediates_;
     }
 
+    // Indexes the literals that storeI() has added to the immediates, by
+    // Hash::input(), so that compiling a literal doesn't search through
+    // every immediate.
+    std::unordered_multimap<size_t, ImmediateId>& constants()
+    {
+        return constants_;
+    }
+
+    // Returns the symbol named by the text of str, creating it the first
+    // time. Symbols are interned in a hash table keyed by their UTF-8 bytes,
+    // so symbols with the same name are the same value, and compare by
+    // address.
+    Heap::Ptr<Symbol> intern(Heap::Ptr<String> str);
+
+    // As intern(), but also stores the symbol in the immediates, for
+    // compiled code to refer to, and returns its location.
+    ImmediateId internImmediate(Heap::Ptr<String> str);
+
+    struct InternedSymbol {
+        ValuePtr symbol_;
+        // The symbol's location in the immediates, or noImmediate. The
+        // table doesn't keep other symbols alive, see
+        // MarkCompact::sweepSymbols().
+        size_t immediate_;
+    };
+
+    static constexpr const size_t noImmediate = -1;
+
+    using SymbolTable = std::unordered_map<std::string, InternedSymbol>;
+
+    SymbolTable& symbols()
+    {
+        return symbols_;
+    }
+
+    // Calls visit on each of the values that the context allocates up
+    // front: the booleans, null, and the ASCII characters (see
+    // Environment::getCharacter()).
+    template <typename F> void forEachConstant(F&& visit)
+    {
+        for (auto& val : booleans_) {
+            visit(val);
+        }
+        visit(nullValue_);
+        for (auto& val : asciiCharacters_) {
+            visit(val);
+        }
+    }
+
     std::vector<ValuePtr>& operandStack()
     {
         return operandStack_;
@@ -138,18 +261,128 @@ public:
 
     void runGC(Environment& env)
     {
+        const auto top = heap_.end();
         collector_->run(env, heap_);
+        collected(top);
+    }
+
+    // Values with non-trivial destructors, in address order. The collector
+    // finalizes the dead ones, and everything left over gets finalized when
+    // the context is destroyed.
+    std::vector<ValuePtr>& finalizable()
+    {
+        return finalizable_;
+    }
+
+    GCHistory& gcHistory()
+    {
+        return gcHistory_;
+    }
+
+    // Must be called when storing a reference into an existing value or
+    // environment frame, see IncrementalMarkCompact. The overloads that take
+    // the frame or value being stored into also let an open region remember
+    // containers from outside of it, see Region.
+    inline void writeBarrier(ValuePtr val)
+    {
+        if (incremental_) {
+            incremental_->writeBarrier(val);
+        }
+    }
+
+    inline void writeBarrier(Environment& frame, ValuePtr val)
+    {
+        writeBarrier(val);
+        if (UNLIKELY(region_.contains(val.get())) and
+            frame.regionVisit(region_.serial())) {
+            region_.rememberedFrames().push_back(frame.reference());
+        }
+    }
+
+    inline void writeBarrier(ValuePtr container, ValuePtr val)
+    {
+        writeBarrier(val);
+        if (UNLIKELY(region_.contains(val.get())) and
+            not region_.contains(container.get()) and
+            not container->remembered()) {
+            container->setRemembered(true);
+            region_.rememberedValues().push_back(container);
+        }
+    }
+
+    // While a region is open, every value that the context creates is bump
+    // allocated in the region's arena, rather than in the heap, and
+    // collections leave the region alone. Closing the region moves whatever
+    // is still reachable from the roots (e.g. values bound to globals, or
+    // held by persistents) into the heap, and discards the rest of the
+    // arena without running a collection, so a short script that leaves
+    // little behind costs almost nothing to clean up. If the arena fills up,
+    // the same happens early, and the region stays open, starting over in
+    // the emptied arena. Regions don't nest, and should be closed where
+    // every live value is reachable from the roots, e.g. between calls to
+    // exec().
+    void openRegion();
+
+    struct RegionStat {
+        size_t allocated_; // Bytes allocated in the region
+        size_t promoted_;  // Bytes moved into the heap when it closed
+    };
+
+    RegionStat closeRegion();
+
+    // The vm polls safepoints at calls and loop edges, where every live value
+    // is reachable from the roots, to let an incremental collector finish
+    // its cycle. This includes calls made from native code, through
+    // Function::call().
+    inline void safepoint(Environment& env)
+    {
+        if (UNLIKELY(incremental_ and incremental_->finishRequested())) {
+            const auto top = heap_.end();
+            incremental_->finish(env, heap_);
+            collected(top);
+        }
+    }
+
+    // Starts a new allocation profile, sampling about once every interval
+    // bytes. An interval of zero stops profiling.
+    void profileAllocations(size_t interval);
+
+    // Null unless profiling allocations.
+    const AllocationProfile* allocationProfile() const
+    {
+        return allocationProfile_.get();
+    }
+
+    // Maintained by the vm, so that the allocation profiler knows what the
+    // mutator was doing when it allocated.
+    struct ExecutionSite {
+        const InstructionAddress* ip_;
+        CFunction native_;
+    };
+
+    ExecutionSite& executionSite()
+    {
+        return executionSite_;
     }
 
     void writeToFile(const std::string& fname);
 
     void loadFromFile(const std::string& fname);
 
+    // Writes every value in the heap, with its outgoing references, along
+    // with the roots, see heapSnapshot.hpp for the format.
+    void writeHeapSnapshot(const std::string& fname);
+
     const Bytecode& getProgram() const
     {
         return program_;
     }
 
+    HandleStack& handles()
+    {
+        return handles_;
+    }
+
     PersistentBase*& getPersistentsList()
     {
         return persistentsList_;
@@ -160,47 +393,203 @@ public:
         size_t remaining_;
     };
 
+    // Allocates a list of count elements as a single run of cdr-coded
+    // Pairs, see Pair::cdrCodedSize. The allocation may trigger a
+    // collection, so element(i), which returns the ith element, is only
+    // called afterwards, and needs to read the elements from somewhere that
+    // the collector updates, e.g. handles or the operand stack. Runs always
+    // go in the compacted heap, even with the segregated layout, or in a
+    // region, unless the run is larger than the region's whole arena.
+    template <typename F>
+    ValuePtr createList(Environment& env, size_t count, F&& element)
+    {
+        if (count == 0) {
+            return nullValue_;
+        }
+        const size_t bytes = (count - 1) * Pair::cdrCodedSize + sizeof(Pair);
+        const bool inRegion =
+            region_.isOpen() and bytes <= region_.arena().capacity();
+        if (incremental_ and not inRegion) {
+            incremental_->step(env, heap_, bytes);
+        }
+        void* mem = inRegion ? region_.tryAllocBytes(bytes)
+                             : heap_.tryAllocBytes(bytes);
+        if (UNLIKELY(mem == nullptr)) {
+            mem = allocSlow(env, inRegion, [&] {
+                return inRegion ? region_.tryAllocBytes(bytes)
+                                : heap_.tryAllocBytes(bytes);
+            });
+        }
+        uint8_t* cell = (uint8_t*)mem;
+        for (size_t i = 0; i < count - 1; ++i) {
+            new (cell) Pair(element(i), Pair::CdrNext{});
+            cell += Pair::cdrCodedSize;
+        }
+        new (cell) Pair(element(count - 1), nullValue_);
+        if (UNLIKELY(region_.isOpen() and not inRegion)) {
+            // The elements may be in the region, which needs to remember
+            // the pairs from outside of it that reference them.
+            cell = (uint8_t*)mem;
+            for (size_t i = 0; i < count; ++i) {
+                auto pair = Heap::wrap(cell).cast<Pair>();
+                writeBarrier(pair, pair->getCar());
+                cell += Pair::cdrCodedSize;
+            }
+        }
+        if (incremental_ and not inRegion) {
+            cell = (uint8_t*)mem;
+            for (size_t i = 0; i < count; ++i) {
+                incremental_->allocated(Heap::wrap(cell).cast<Value>());
+                cell += Pair::cdrCodedSize;
+            }
+        }
+        if (UNLIKELY(allocationProfile_ != nullptr) and
+            allocationProfile_->allocated(bytes)) {
+            sampleAllocation(typeId<Pair>());
+        }
+        return Heap::wrap(mem).cast<Value>();
+    }
+
     MemoryStat memoryStat() const
     {
-        return {heap_.size(), heap_.capacity() - heap_.size()};
+        const size_t used = heap_.size() + (pages_ ? pages_->size() : 0);
+        const size_t capacity =
+            heap_.capacity() + (pages_ ? pages_->capacity() : 0);
+        return {used, capacity - used};
     }
 
 private:
     template <typename T, typename... Args>
     Heap::Ptr<T> create(Environment& env, Args&&... args)
     {
-        auto allocVal = [&] { return heap_.alloc<T>().template cast<T>(); };
-        auto mem = alloc<T>(env, allocVal);
+        const bool inRegion = region_.isOpen();
+        if (incremental_ and not inRegion) {
+            incremental_->step(env, heap_, sizeof(T));
+        }
+        using Eligible = typename PageSpace::Eligible<T>::type;
+        void* raw =
+            inRegion ? region_.tryAlloc<T>() : tryAllocRaw<T>(Eligible{});
+        if (UNLIKELY(raw == nullptr)) {
+            raw = allocSlow(env, inRegion, [&] {
+                return inRegion ? region_.tryAlloc<T>()
+                                : tryAllocRaw<T>(Eligible{});
+            });
+        }
+        auto mem = Heap::wrap(raw).template cast<T>();
         ConstructImpl<T>::construct(mem.get(), env,
                                     std::forward<Args>(args)...);
+        if (not std::is_trivially_destructible<T>::value) {
+            (inRegion ? region_.finalizable() : finalizable_).push_back(mem);
+        }
+        if (incremental_ and not inRegion) {
+            incremental_->allocated(mem);
+        }
+        if (UNLIKELY(allocationProfile_ != nullptr) and
+            allocationProfile_->allocated(sizeof(T))) {
+            sampleAllocation(typeId<T>());
+        }
         return mem;
     }
 
-    template <typename T, typename F>
-    Heap::Ptr<T> alloc(Environment& env, F&& allocImpl)
+    // The allocation slow path, taken when there's no room on the fast
+    // path. Runs a collection, or for a full region, moves what's still
+    // reachable out of it, and retries once. The fast path only tests the
+    // result of a bump allocation for null, and stays small enough to be
+    // inlined into the vm, so the slow path is kept out of line.
+    template <typename F>
+    NOINLINE void* allocSlow(Environment& env, bool inRegion, F&& retry)
     {
-        try {
-            return allocImpl();
-        } catch (const Heap::OOM& oom) {
+        if (inRegion) {
+            recycleRegion();
+        } else {
             runGC(env);
-            return allocImpl();
         }
+        if (auto mem = retry()) {
+            return mem;
+        }
+        throw Heap::OOM{};
     }
 
-    static const Configuration& defaultConfig();
+    // Moves the values in the region that are still reachable into the
+    // heap. Returns the number of bytes moved.
+    size_t evacuateRegion();
+
+    // Empties the region's arena, leaving the region open.
+    void recycleRegion();
+
+    void sampleAllocation(TypeId type);
+
+    // Returns null when the space is exhausted.
+    template <typename T> void* tryAllocRaw(std::true_type)
+    {
+        if (pages_) {
+            return pages_->alloc<T>();
+        }
+        return heap_.tryAlloc<T>();
+    }
+
+    template <typename T> void* tryAllocRaw(std::false_type)
+    {
+        return heap_.tryAlloc<T>();
+    }
+
+    // Releases the unused tail of the heap, after a collection compacted it
+    // down from top.
+    void collected(uint8_t* top);
+
+    InternedSymbol& internEntry(Heap::Ptr<String> str);
 
     Heap heap_;
+    uint8_t* heapHighWater_;
+    size_t heapReleaseThreshold_;
+    std::unique_ptr<PageSpace> pages_;
+    Region region_;
+    size_t regionAllocated_ = 0; // Before the arena was last recycled
+    size_t regionPromoted_ = 0;
+    std::unique_ptr<GC> collector_;
+    IncrementalMarkCompact* incremental_;
+    // Read by create(), so these need to be initialized before the values
+    // that the constructor allocates below.
+    std::unique_ptr<AllocationProfile> allocationProfile_;
+    ExecutionSite executionSite_ = {nullptr, nullptr};
     EnvPtr topLevel_;
     Heap::Ptr<Boolean> booleans_[2];
     Heap::Ptr<Null> nullValue_;
+    std::vector<Heap::Ptr<Character>> asciiCharacters_;
     std::vector<ValuePtr> immediates_;
+    std::unordered_multimap<size_t, ImmediateId> constants_;
+    SymbolTable symbols_;
     std::vector<ValuePtr> operandStack_;
+    std::vector<ValuePtr> finalizable_;
     std::vector<DLL> dlls_;
     ast::TopLevel* astRoot_ = nullptr;
     Bytecode program_;
-    std::unique_ptr<GC> collector_;
     CallStack callStack_;
+    HandleStack handles_;
     PersistentBase* persistentsList_;
+    GCHistory gcHistory_;
+};
+
+// Sets the context's execution site, restoring the enclosing site when it
+// goes out of scope.
+class ExecutionSiteScope {
+public:
+    ExecutionSiteScope(Context& context, const Context::ExecutionSite& site)
+        : site_(context.executionSite()), saved_(site_)
+    {
+        site_ = site;
+    }
+
+    ExecutionSiteScope(const ExecutionSiteScope&) = delete;
+
+    ~ExecutionSiteScope()
+    {
+        site_ = saved_;
+    }
+
+private:
+    Context::ExecutionSite& site_;
+    const Context::ExecutionSite saved_;
 };
 
 template <typename T, typename... Args>
@@ -209,36 +598,50 @@ Heap::Ptr<T> Environment::create(Args&&... args)
     return context_->create<T>(*this, std::forward<Args>(args)...);
 }
 
+template <typename F>
+ValuePtr Environment::createList(size_t count, F&& element)
+{
+    return context_->createList(*this, count, std::forward<F>(element));
+}
+
+HandleScope::HandleScope(Environment& env)
+    : HandleScope(env.getContext()->handles())
+{
+}
+
+template <typename T>
+Handle<T>::Handle(Environment& env, Heap::Ptr<T> val)
+    : Handle(env.getContext()->handles(), val)
+{
+}
+
+HandleBuffer::HandleBuffer(Environment& env)
+    : HandleBuffer(env.getContext()->handles())
+{
+}
+
 template <typename T>
 ImmediateId storeI(Context& context, const typename T::Input& val)
 {
     auto& immediates = context.immediates();
-    const auto ret = immediates.size();
-    for (size_t i = 0; i < immediates.size(); ++i) {
-        if (isType<T>(immediates[i])) {
-            if (immediates[i].cast<T>()->value() == val) {
-                return i;
-            }
+    const auto hash = Hash::input<T>(val);
+    const auto candidates = context.constants().equal_range(hash);
+    for (auto it = candidates.first; it not_eq candidates.second; ++it) {
+        const ValuePtr& candidate = immediates[it->second];
+        if (isType<T>(candidate) and candidate.cast<T>()->value() == val) {
+            return it->second;
         }
     }
+    const ImmediateId ret = immediates.size();
     immediates.push_back(context.topLevel().create<T>(val));
+    context.constants().emplace(hash, ret);
     return ret;
 }
 
 template <>
 inline ImmediateId storeI<Symbol>(Context& context, const Heap::Ptr<String>& val)
 {
-    auto& immediates = context.immediates();
-    const auto ret = immediates.size();
-    for (size_t i = 0; i < immediates.size(); ++i) {
-        if (isType<Symbol>(immediates[i])) {
-            if (*immediates[i].cast<Symbol>()->value() == *val) {
-                return i;
-            }
-        }
-    }
-    immediates.push_back(context.topLevel().create<Symbol>(val));
-    return ret;
+    return context.internImmediate(val);
 }
 
 } // namespace ebl
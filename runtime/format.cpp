@@ -0,0 +1,61 @@
+#include "format.hpp"
+#include "ebl.hpp"
+#include <unordered_map>
+
+namespace ebl {
+
+Format::Format(const char* text, size_t bytes)
+{
+    for (size_t i = 0; i < bytes; ++i) {
+        const char c = text[i];
+        if (c == '{' and i + 1 < bytes and text[i + 1] == '}') {
+            breaks_.push_back(literal_.size());
+            ++i;
+        } else if ((c == '{' or c == '}') and i + 1 < bytes and
+                   text[i + 1] == c) {
+            literal_.push_back(c);
+            ++i;
+        } else if (c == '{' or c == '}') {
+            throw std::runtime_error("unmatched brace in format template");
+        } else {
+            literal_.push_back(c);
+        }
+    }
+}
+
+void Format::render(Environment& env, const Arguments& args, size_t first,
+                    std::string& out) const
+{
+    if (args.count() - first not_eq breaks_.size()) {
+        throw std::runtime_error(
+            "format template expects " + std::to_string(breaks_.size()) +
+            " args, but was given " + std::to_string(args.count() - first));
+    }
+    size_t written = 0;
+    for (size_t i = 0; i < breaks_.size(); ++i) {
+        out.append(literal_, written, breaks_[i] - written);
+        written = breaks_[i];
+        print(env, args[first + i], out, false);
+    }
+    out.append(literal_, written, std::string::npos);
+}
+
+const Format& compileFormat(const char* text, size_t bytes)
+{
+    // Scripts tend to use a handful of templates, over and over. A script
+    // that builds its templates on the fly just starts over now and then.
+    static const size_t cacheLimit = 256;
+    static thread_local std::unordered_map<std::string, Format> cache;
+    std::string key(text, bytes);
+    auto found = cache.find(key);
+    if (found not_eq cache.end()) {
+        return found->second;
+    }
+    Format compiled(text, bytes);
+    if (cache.size() >= cacheLimit) {
+        cache.clear();
+    }
+    return cache.emplace(std::move(key), std::move(compiled)).first->second;
+}
+
+} // namespace ebl
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+namespace ebl {
+
+class Environment;
+class Arguments;
+
+// A template string, parsed once into the literal text between its
+// placeholders. Each {} is replaced by the printed form of the next
+// argument, and {{ and }} stand for literal braces.
+class Format {
+public:
+    Format(const char* text, size_t bytes);
+
+    size_t placeholders() const
+    {
+        return breaks_.size();
+    }
+
+    // Appends the template to out, filling the placeholders with args,
+    // beginning at args[first]. Throws unless the remaining args exactly fill
+    // the placeholders.
+    void render(Environment& env, const Arguments& args, size_t first,
+                std::string& out) const;
+
+private:
+    // The template with the placeholders removed, and the offsets into it
+    // where each placeholder was.
+    std::string literal_;
+    std::vector<size_t> breaks_;
+};
+
+// Returns the compiled form of the template text, compiling it on first use.
+// The compiled templates are cached per thread, and the reference stays
+// valid until the next call.
+const Format& compileFormat(const char* text, size_t bytes);
+
+} // namespace ebl
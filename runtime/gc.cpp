@@ -2,8 +2,10 @@
 #include "environment.hpp"
 #include "memory.hpp"
 #include "persistent.hpp"
-#include <deque>
+#include <algorithm>
+#include <atomic>
 #include <set>
+#include <thread>
 
 // FIXME: This code could use a good deal of work! On the one hand,
 // it's a reasonably performant mark/compact collector in less than
@@ -11,208 +13,719 @@
 
 namespace ebl {
 
-static void markFrame(Environment& frame);
+using Clock = std::chrono::steady_clock;
 
-static void markValue(ValuePtr val)
+void MarkCompact::shade(ValuePtr val)
 {
-    if (val->marked()) {
-        return;
+    if (not testAndMark(val.get())) {
+        grayStack_.push_back(val);
+    }
+}
+
+size_t MarkCompact::footprint(const Heap& heap) const
+{
+    return heap.size() + (pages_ ? pages_->size() : 0);
+}
+
+size_t MarkCompact::capacity(const Heap& heap) const
+{
+    return heap.capacity() + (pages_ ? pages_->capacity() : 0);
+}
+
+template <typename F>
+void MarkCompact::traceFrames(Environment& frame, F&& visit)
+{
+    // Captured variables live in the parent frames, so the whole chain needs
+    // to be traced, up to the first frame that has already been visited.
+    Environment* current = &frame;
+    while (current and current->gcVisit(epoch_)) {
+        for (auto& val : current->getVars()) {
+            visit(val);
+        }
+        current = current->parent().get();
     }
-    val->mark();
+}
+
+void MarkCompact::traceFrames(Environment& frame)
+{
+    traceFrames(frame, [this](ValuePtr val) { shade(val); });
+}
+
+template <typename F> void MarkCompact::trace(ValuePtr val, F&& visit)
+{
     switch (val->typeId()) {
     case typeId<Pair>():
-        markValue(val.cast<Pair>()->getCar());
-        markValue(val.cast<Pair>()->getCdr());
+        visit(val.cast<Pair>()->getCar());
+        visit(val.cast<Pair>()->getCdr());
         break;
 
     case typeId<Function>():
-        markFrame(*val.cast<Function>()->definitionEnvironment());
-        markValue(val.cast<Function>()->getDocstring());
+        traceFrames(*val.cast<Function>()->definitionEnvironment(), visit);
+        visit(val.cast<Function>()->getDocstring());
         break;
 
     case typeId<Symbol>():
-        markValue(val.cast<Symbol>()->value());
+        visit(val.cast<Symbol>()->value());
         break;
 
     case typeId<Box>():
-        markValue(val.cast<Box>()->get());
+        visit(val.cast<Box>()->get());
         break;
     }
 }
 
-static void markFrame(Environment& frame)
+bool MarkCompact::drain(size_t budget, std::chrono::microseconds timeBudget)
 {
-    for (auto& val : frame.getVars()) {
-        markValue(val);
+    const auto start = Clock::now();
+    size_t work = 0;
+    while (not grayStack_.empty()) {
+        if (budget and work >= budget) {
+            return false;
+        }
+        if (timeBudget.count() and (work & 63) == 63 and
+            Clock::now() - start >= timeBudget) {
+            return false;
+        }
+        ++work;
+        auto val = grayStack_.back();
+        grayStack_.pop_back();
+        trace(val, [this](ValuePtr child) { shade(child); });
     }
+    return true;
 }
 
-void MarkCompact::mark(Environment& env)
+bool MarkCompact::testAndMarkShared(Value* val)
+{
+    if (marks_.contains(val)) {
+        return marks_.testAndMarkShared(val, valueSize(val));
+    }
+    if (pages_ and pages_->contains(val)) {
+        return pages_->testAndMarkShared(val);
+    }
+    return true;
+}
+
+namespace {
+
+// Each worker marks from a private stack, and shares part of it, through a
+// locked stack, when it grows and the shared stack has run dry. Workers
+// that run out of values take from their own shared stack first, and then
+// steal from the others.
+struct MarkStack {
+    Spinlock lock_;
+    std::vector<ValuePtr> vals_;
+    std::atomic<size_t> size_{0};
+
+    static constexpr const size_t shareBatch = 32;
+
+    void share(std::vector<ValuePtr>& local)
+    {
+        std::lock_guard<Spinlock> guard(lock_);
+        vals_.insert(vals_.end(), local.begin(), local.begin() + shareBatch);
+        local.erase(local.begin(), local.begin() + shareBatch);
+        size_ = vals_.size();
+    }
+
+    // Moves half of the shared values, at least one, into local.
+    bool take(std::vector<ValuePtr>& local)
+    {
+        if (size_ == 0) {
+            return false;
+        }
+        std::lock_guard<Spinlock> guard(lock_);
+        if (vals_.empty()) {
+            return false;
+        }
+        const size_t count = std::max(vals_.size() / 2, size_t(1));
+        local.insert(local.end(), vals_.end() - count, vals_.end());
+        vals_.erase(vals_.end() - count, vals_.end());
+        size_ = vals_.size();
+        return true;
+    }
+};
+
+} // namespace
+
+void MarkCompact::drainParallel()
 {
+    const size_t count = workers_->count();
+    std::vector<std::unique_ptr<MarkStack>> stacks;
+    for (size_t i = 0; i < count; ++i) {
+        stacks.emplace_back(new MarkStack);
+    }
+    for (size_t i = 0; i < grayStack_.size(); ++i) {
+        stacks[i % count]->vals_.push_back(grayStack_[i]);
+    }
+    for (auto& stack : stacks) {
+        stack->size_ = stack->vals_.size();
+    }
+    grayStack_.clear();
+    std::atomic<size_t> idle{0};
+    workers_->run([&](size_t self) {
+        std::vector<ValuePtr> local;
+        auto visit = [&](ValuePtr child) {
+            if (not testAndMarkShared(child.get())) {
+                local.push_back(child);
+            }
+        };
+        MarkStack& own = *stacks[self];
+        while (true) {
+            while (not local.empty()) {
+                auto val = local.back();
+                local.pop_back();
+                trace(val, visit);
+                if (local.size() >= 2 * MarkStack::shareBatch and
+                    own.size_ == 0) {
+                    own.share(local);
+                }
+            }
+            bool found = own.take(local);
+            for (size_t i = 1; i < count and not found; ++i) {
+                found = stacks[(self + i) % count]->take(local);
+            }
+            if (found) {
+                continue;
+            }
+            // Marking is done once every worker is idle, at which point no
+            // worker has any values left to share.
+            ++idle;
+            while (true) {
+                if (idle == count) {
+                    return;
+                }
+                bool pending = false;
+                for (auto& stack : stacks) {
+                    pending = pending or stack->size_ not_eq 0;
+                }
+                if (pending) {
+                    --idle;
+                    break;
+                }
+                std::this_thread::yield();
+            }
+        }
+    });
+}
+
+template <typename F>
+size_t MarkCompact::visitRoots(Environment& env, F&& visit)
+{
+    traceFrames(env.getContext()->topLevel(), visit);
     for (auto& frameInfo : env.getContext()->callStack()) {
-        markFrame(*frameInfo.env_);
+        traceFrames(*frameInfo.env_, visit);
     }
     for (auto& val : env.getContext()->immediates()) {
-        markValue(val);
+        visit(val);
     }
     for (auto& val : env.getContext()->operandStack()) {
-        markValue(val);
+        visit(val);
     }
+    env.getContext()->handles().forEach(visit);
+    size_t persistents = 0;
     auto plist = env.getContext()->getPersistentsList();
     while (plist) {
-        markValue(plist->getUntypedVal());
+        visit(plist->getUntypedVal());
         plist = plist->next();
+        ++persistents;
     }
-    env.getBool(true)->mark();
-    env.getBool(false)->mark();
-    env.getNull()->mark();
+    return persistents;
 }
 
-using BreakList = std::vector<std::pair<Value*, size_t>>;
+void MarkCompact::markRoots(Environment& env)
+{
+    // An incremental cycle scans the roots at its start and again in its
+    // final pause, so the persistents are counted by the latest scan only.
+    stats_.persistentsScanned_ =
+        visitRoots(env, [this](ValuePtr val) { shade(val); });
+    env.getContext()->forEachConstant([this](ValuePtr val) { shade(val); });
+    if (region_ and region_->isOpen()) {
+        region_->forEach([this](Value* val) {
+            trace(Heap::wrap(val).cast<Value>(),
+                  [this](ValuePtr child) { shade(child); });
+        });
+        for (auto& frame : region_->rememberedFrames()) {
+            traceFrames(*frame);
+        }
+        for (auto& val : region_->rememberedValues()) {
+            shade(val);
+        }
+    }
+}
 
-static void* remapValueAddress(void* val, const BreakList& breaks)
+void MarkCompact::mark(Environment& env)
 {
-    size_t shiftAmount = 0;
-    auto iter = breaks.begin();
-    while (iter not_eq breaks.end() and iter->first < val) {
-        shiftAmount += iter->second;
-        ++iter;
+    const auto start = Clock::now();
+    ++epoch_;
+    markRoots(env);
+    if (workers_) {
+        drainParallel();
+    } else {
+        drain(0, std::chrono::microseconds(0));
     }
-    return (uint8_t*)val - shiftAmount;
+    stats_.markTime_ += Clock::now() - start;
 }
 
-// Frames must be visited exactly once! FIXME: but the var shouldn't be global.
-thread_local std::set<Environment*> frameSet;
+void MarkCompact::beginCycle()
+{
+    stats_ = GCStats{};
+}
+
+void MarkCompact::endCycle(Environment& env, Heap& heap)
+{
+    stats_.finished_ = std::chrono::system_clock::now();
+    stats_.bytesLive_ = footprint(heap);
+    env.getContext()->gcHistory().record(stats_);
+}
+
+struct Forwarding {
+    const MarkBitmap& marks_;
 
-static void remapFrame(Environment& frame, const BreakList& breaks)
+    // Only addresses within the space being compacted, as it was before
+    // compaction, move. Values may also live in the page space, in a
+    // region, or inside of strings.
+    uint8_t* heapBegin_;
+    uint8_t* heapEnd_;
+
+    // Where the live values end up, the start of the heap, or for a region
+    // being evacuated, the space allocated for it in the heap.
+    uint8_t* destination_;
+};
+
+static void* remapValueAddress(void* val, const Forwarding& forwarding)
+{
+    if (val < forwarding.heapBegin_ or val >= forwarding.heapEnd_) {
+        return val;
+    }
+    return forwarding.destination_ + forwarding.marks_.liveBytesBefore(val);
+}
+
+static void remapFrame(Environment& frame, const Forwarding& forwarding)
 {
     for (auto& val : frame.getVars()) {
-        val.UNSAFE_overwrite(remapValueAddress(val.handle(), breaks));
+        val.UNSAFE_overwrite(remapValueAddress(val.handle(), forwarding));
     }
 }
 
-static void gatherFrames(Environment& env)
+// Frames must be remapped exactly once, so they're gathered into a set.
+static void gatherFrames(Environment& env, std::set<Environment*>& frames)
 {
     auto current = env.reference();
     while (current) {
-        frameSet.insert(current.get());
+        frames.insert(current.get());
         current = current->parent();
     }
 }
 
-static void remapInternalPointers(Value* val, const BreakList& breaks)
+static void remapInternalPointers(Value* val, const Forwarding& forwarding,
+                                  std::set<Environment*>& frames)
 {
     switch (val->typeId()) {
     case typeId<Pair>(): {
         auto p = (Pair*)val;
         auto car = p->getCar();
-        auto cdr = p->getCdr();
-        car.UNSAFE_overwrite(remapValueAddress(car.handle(), breaks));
-        cdr.UNSAFE_overwrite(remapValueAddress(cdr.handle(), breaks));
+        car.UNSAFE_overwrite(remapValueAddress(car.handle(), forwarding));
         p->setCar(car);
-        p->setCdr(cdr);
+        // A cdr-coded cell's cdr is implicit, and moves along with it.
+        if (not p->cdrCoded()) {
+            auto cdr = p->getCdr();
+            cdr.UNSAFE_overwrite(remapValueAddress(cdr.handle(), forwarding));
+            p->setCdr(cdr);
+        }
     } break;
 
     case typeId<Symbol>(): {
         auto s = (Symbol*)val;
         auto val = s->value();
-        val.UNSAFE_overwrite(remapValueAddress(val.handle(), breaks));
+        val.UNSAFE_overwrite(remapValueAddress(val.handle(), forwarding));
         s->set(val);
     } break;
 
     case typeId<Box>(): {
         auto b = (Box*)val;
         auto val = b->get();
-        val.UNSAFE_overwrite(remapValueAddress(val.handle(), breaks));
+        val.UNSAFE_overwrite(remapValueAddress(val.handle(), forwarding));
         b->set(val);
     } break;
 
     case typeId<Function>(): {
         auto f = (Function*)val;
         auto doc = f->getDocstring();
-        doc.UNSAFE_overwrite(remapValueAddress(doc.handle(), breaks));
+        doc.UNSAFE_overwrite(remapValueAddress(doc.handle(), forwarding));
         f->setDocstring(doc);
-        gatherFrames(*f->definitionEnvironment());
+        gatherFrames(*f->definitionEnvironment(), frames);
         break;
     }
     }
 }
 
-void MarkCompact::compact(Environment& env, Heap& heap)
+namespace {
+
+struct SlideStats {
+    std::array<size_t, typeCount> liveObjects_{};
+    size_t breaks_ = 0;
+    std::set<Environment*> frames_;
+};
+
+} // namespace
+
+// Moves the live values in [begin, end) down to their forwarding addresses.
+// Live values are visited in address order, and only ever move down, so
+// each one can be remapped and moved in one pass, without overwriting a
+// value that hasn't been visited yet. Dead values are skipped by way of the
+// mark bitmap, and never read.
+static void slideRegion(Heap& heap, size_t begin, size_t end,
+                        const Forwarding& forwarding, SlideStats& stats)
 {
-    BreakList breakList;
-    size_t bytesCompacted = 0;
-    size_t index = 0;
-    bool collapse = false; // collapse consecutive vals
-    while (index < heap.size()) {
-        auto current = (Value*)(heap.begin() + index);
-        const size_t currentSize = typeInfo(current).size_;
-        if (current->marked()) {
-        PRESERVE:
-            current->unmark();
-            collapse = false;
-            if (bytesCompacted) {
-                uint8_t* const dest = ((uint8_t*)current) - bytesCompacted;
-                typeInfo(current).relocatePolicy(current, dest);
-            }
-        } else {
-            if (isType<String>(current)) {
-                auto s = (String*)current;
-                for (size_t i = 0; i < s->length(); ++i) {
-                    // If there are any outstanding references to the characters
-                    // belonging to the string, we can't collect it yet.
-                    if ((*s)[i]->marked())
-                        goto PRESERVE;
+    const MarkBitmap& marks = forwarding.marks_;
+    size_t expected = begin;
+    size_t offset = marks.nextMarked(begin, end);
+    while (offset < end) {
+        if (offset not_eq expected) {
+            ++stats.breaks_;
+        }
+        auto current = (Value*)(heap.begin() + offset);
+        const size_t currentSize = valueSize(current);
+        ++stats.liveObjects_[current->typeId()];
+        remapInternalPointers(current, forwarding, stats.frames_);
+        uint8_t* const dest = marks.forward(current);
+        if (dest not_eq (uint8_t*)current) {
+            typeInfo(current).relocatePolicy(current, dest);
+        }
+        expected = offset + currentSize;
+        offset = marks.nextMarked(expected, end);
+    }
+    if (expected not_eq end) {
+        ++stats.breaks_;
+    }
+}
+
+void MarkCompact::slide(Heap& heap, const Forwarding& forwarding,
+                        std::set<Environment*>& frames)
+{
+    // With several workers, the heap is split into a few regions per
+    // worker, each beginning with a live value, and the workers claim
+    // regions in address order. A region's values land in the space of the
+    // regions before it, so before moving anything, a worker waits for the
+    // regions overlapping its destination to be moved out of the way.
+    const size_t heapSize = heap.size();
+    const size_t workerCount = workers_ ? workers_->count() : 1;
+    const size_t regionCount = workers_ ? workerCount * 4 : 1;
+    std::vector<size_t> bounds{0};
+    for (size_t i = 1; i < regionCount; ++i) {
+        const size_t split = heapSize / regionCount * i / Heap::Align *
+                             Heap::Align;
+        const size_t bound =
+            marks_.nextRun(std::max(split, bounds.back()), heapSize);
+        if (bound > bounds.back() and bound < heapSize) {
+            bounds.push_back(bound);
+        }
+    }
+    bounds.push_back(heapSize);
+    const size_t regions = bounds.size() - 1;
+    std::unique_ptr<std::atomic<bool>[]> moved(new std::atomic<bool>[regions]);
+    for (size_t i = 0; i < regions; ++i) {
+        moved[i] = false;
+    }
+    std::vector<SlideStats> stats(workerCount);
+    std::atomic<size_t> nextRegion{0};
+    auto job = [&](size_t worker) {
+        size_t region;
+        while ((region = nextRegion++) < regions) {
+            const size_t begin = bounds[region];
+            const size_t end = bounds[region + 1];
+            const size_t first = marks_.nextMarked(begin, end);
+            if (first < end) {
+                const size_t dest =
+                    marks_.forward(heap.begin() + first) - heap.begin();
+                size_t blocker =
+                    std::upper_bound(bounds.begin(), bounds.end(), dest) -
+                    bounds.begin() - 1;
+                for (; blocker < region; ++blocker) {
+                    while (not moved[blocker].load(std::memory_order_acquire)) {
+                        std::this_thread::yield();
+                    }
                 }
             }
-            if (not collapse) {
-                breakList.push_back({current, currentSize});
-                collapse = true;
-            } else {
-                breakList.back().second += currentSize;
-            }
-            bytesCompacted += currentSize;
+            slideRegion(heap, begin, end, forwarding, stats[worker]);
+            moved[region].store(true, std::memory_order_release);
         }
-        index += currentSize;
+    };
+    if (workers_) {
+        workers_->run(job);
+    } else {
+        job(0);
     }
-    heap.compacted(bytesCompacted);
-    index = 0;
-    while (index < heap.size()) {
-        auto current = (Value*)(heap.begin() + index);
-        const size_t currentSize = typeInfo(current).size_;
-        remapInternalPointers(current, breakList);
-        index += currentSize;
+    for (auto& workerStats : stats) {
+        for (size_t i = 0; i < typeCount; ++i) {
+            stats_.liveObjects_[i] += workerStats.liveObjects_[i];
+        }
+        stats_.breaks_ += workerStats.breaks_;
+        frames.insert(workerStats.frames_.begin(), workerStats.frames_.end());
     }
-    for (auto& frameInfo : env.getContext()->callStack()) {
-        gatherFrames(*frameInfo.env_);
+}
+
+void MarkCompact::finalize(Environment& env)
+{
+    // Dead values that own resources outside of the heap are destroyed in
+    // one batch, before compaction starts overwriting them. Trivially
+    // destructible types are never added to the list, so they cost nothing
+    // here.
+    auto& registry = env.getContext()->finalizable();
+    auto live = registry.begin();
+    for (auto& val : registry) {
+        if (marked(val.get())) {
+            *(live++) = val;
+        } else {
+            typeInfo(val).finalizer(val.get());
+            ++stats_.finalized_;
+        }
     }
-    for (auto& frame : frameSet) {
-        remapFrame(*frame, breakList);
+    registry.erase(live, registry.end());
+}
+
+void MarkCompact::sweepSymbols(Environment& env)
+{
+    auto& symbols = env.getContext()->symbols();
+    for (auto it = symbols.begin(); it not_eq symbols.end();) {
+        if (marked(it->second.symbol_.get())) {
+            ++it;
+        } else {
+            it = symbols.erase(it);
+        }
     }
-    frameSet.clear();
-    for (auto& val : env.getContext()->immediates()) {
-        auto target = remapValueAddress(val.handle(), breakList);
-        val.UNSAFE_overwrite(target);
+}
+
+void MarkCompact::compact(Environment& env, Heap& heap)
+{
+    const auto start = Clock::now();
+    finalize(env);
+    sweepSymbols(env);
+    if (pages_) {
+        stats_.bytesReclaimed_ += pages_->sweep(stats_.liveObjects_);
     }
-    for (auto& val : env.getContext()->operandStack()) {
-        auto target = remapValueAddress(val.handle(), breakList);
-        val.UNSAFE_overwrite(target);
+    const size_t heapSize = heap.size();
+    const size_t liveBytes = marks_.computeForwarding(heapSize);
+    const Forwarding forwarding{marks_, heap.begin(), heap.end(),
+                                heap.begin()};
+    std::set<Environment*> frames;
+    slide(heap, forwarding, frames);
+    heap.compacted(heapSize - liveBytes);
+    stats_.bytesReclaimed_ += heapSize - liveBytes;
+    if (pages_) {
+        pages_->forEachLive([&](Value* val) {
+            remapInternalPointers(val, forwarding, frames);
+        });
     }
-    auto plist = env.getContext()->getPersistentsList();
+    if (region_ and region_->isOpen()) {
+        region_->forEach([&](Value* val) {
+            remapInternalPointers(val, forwarding, frames);
+        });
+    }
+    remapRoots(*env.getContext(), forwarding, frames);
+    marks_.clear(heapSize);
+    stats_.compactTime_ = Clock::now() - start;
+}
+
+namespace {
+struct RemapConstant {
+    const Forwarding& forwarding_;
+
+    template <typename T> void operator()(Heap::Ptr<T>& val) const
+    {
+        val.UNSAFE_overwrite(remapValueAddress(val.handle(), forwarding_));
+    }
+};
+} // namespace
+
+// Remaps the roots, the frames gathered so far, and the frames on the call
+// stack.
+void MarkCompact::remapRoots(Context& context, const Forwarding& forwarding,
+                             std::set<Environment*>& frames)
+{
+    auto remap = [&](ValuePtr& val) {
+        val.UNSAFE_overwrite(remapValueAddress(val.handle(), forwarding));
+    };
+    for (auto& frameInfo : context.callStack()) {
+        gatherFrames(*frameInfo.env_, frames);
+    }
+    if (region_ and region_->isOpen()) {
+        for (auto& frame : region_->rememberedFrames()) {
+            gatherFrames(*frame, frames);
+        }
+        for (auto& val : region_->rememberedValues()) {
+            remap(val);
+        }
+    }
+    for (auto& frame : frames) {
+        remapFrame(*frame, forwarding);
+    }
+    for (auto& val : context.immediates()) {
+        remap(val);
+    }
+    for (auto& val : context.operandStack()) {
+        remap(val);
+    }
+    context.handles().forEach(remap);
+    for (auto& val : context.finalizable()) {
+        remap(val);
+    }
+    for (auto& entry : context.symbols()) {
+        remap(entry.second.symbol_);
+    }
+    // The constants are allocated first, so in practice they never move,
+    // but nothing else guarantees that.
+    context.forEachConstant(RemapConstant{forwarding});
+    auto plist = context.getPersistentsList();
     while (plist) {
         auto val = plist->getUntypedVal();
-        auto target = remapValueAddress(val.handle(), breakList);
-        val.UNSAFE_overwrite(target);
+        remap(val);
         plist->UNSAFE_overwrite(val);
         plist = plist->next();
     }
 }
 
+size_t MarkCompact::evacuate(Environment& env, Heap& heap)
+{
+    // Only the values in the region that are reachable from the roots, or
+    // from the containers that the region remembered, are traced. Values in
+    // the heap can't reference the region otherwise, so the heap itself is
+    // never traced.
+    Context& context = *env.getContext();
+    Region& region = *region_;
+    Heap& arena = region.arena();
+    MarkBitmap& marks = region.marks();
+    ++epoch_;
+    std::vector<ValuePtr> gray;
+    auto visit = [&](ValuePtr val) {
+        if (region.contains(val.get()) and
+            not marks.testAndMark(val.get(), valueSize(val))) {
+            gray.push_back(val);
+        }
+    };
+    visitRoots(env, visit);
+    for (auto& frame : region.rememberedFrames()) {
+        traceFrames(*frame, visit);
+    }
+    for (auto& val : region.rememberedValues()) {
+        trace(val, visit);
+    }
+    while (not gray.empty()) {
+        auto val = gray.back();
+        gray.pop_back();
+        trace(val, visit);
+    }
+    auto& symbols = context.symbols();
+    for (auto it = symbols.begin(); it not_eq symbols.end();) {
+        auto symbol = it->second.symbol_.get();
+        if (region.contains(symbol) and not marks.marked(symbol)) {
+            it = symbols.erase(it);
+        } else {
+            ++it;
+        }
+    }
+    // The escaped values are laid out in the heap in the same order as in
+    // the region, so a cdr-coded run stays contiguous. A collection doesn't
+    // move anything in the region, so the marks stay valid if one is needed
+    // to make room.
+    const size_t bytes = marks.computeForwarding(arena.size());
+    uint8_t* destination = heap.tryAllocBytes(bytes);
+    if (not destination) {
+        run(env, heap);
+        destination = heap.allocBytes(bytes).handle();
+    }
+    const Forwarding forwarding{marks, arena.begin(), arena.end(),
+                                destination};
+    std::set<Environment*> frames;
+    size_t offset = marks.nextMarked(0, arena.size());
+    while (offset < arena.size()) {
+        auto current = (Value*)(arena.begin() + offset);
+        const size_t currentSize = valueSize(current);
+        remapInternalPointers(current, forwarding, frames);
+        typeInfo(current).relocatePolicy(
+            current, (uint8_t*)remapValueAddress(current, forwarding));
+        offset = marks.nextMarked(offset + currentSize, arena.size());
+    }
+    for (auto& val : region.rememberedValues()) {
+        remapInternalPointers(val.get(), forwarding, frames);
+    }
+    remapRoots(context, forwarding, frames);
+    for (auto& val : region.finalizable()) {
+        if (marks.marked(val.get())) {
+            context.finalizable().push_back(
+                Heap::wrap(remapValueAddress(val.get(), forwarding))
+                    .cast<Value>());
+        } else {
+            typeInfo(val).finalizer(val.get());
+        }
+    }
+    return bytes;
+}
+
 
 void MarkCompact::run(Environment& env, Heap& heap)
 {
+    beginCycle();
     mark(env);
     compact(env, heap);
+    endCycle(env, heap);
+}
+
+
+void IncrementalMarkCompact::step(Environment& env, Heap& heap, size_t bytes)
+{
+    // Slices are paced by allocation volume, so that marking keeps up with
+    // the mutator: with a work budget, a slice runs after every
+    // budget * sizeof(Pair) / 2 bytes, i.e. at least two values are traced
+    // per Pair allocated. If the mutator wins anyway, the allocator runs out
+    // of space and finishes the cycle with a full pause.
+    allocatedSinceSlice_ += bytes;
+    const size_t interval =
+        sliceBudget_ ? sliceBudget_ * sizeof(Pair) / 2
+                     : std::max(capacity(heap) / 256, size_t(4096));
+    if (allocatedSinceSlice_ < interval) {
+        return;
+    }
+    allocatedSinceSlice_ = 0;
+    if (not marking_) {
+        if (footprint(heap) >= std::max(trigger_, capacity(heap) / 2)) {
+            const auto start = Clock::now();
+            beginCycle();
+            stats_.incremental_ = true;
+            marking_ = true;
+            ++epoch_;
+            markRoots(env);
+            stats_.markTime_ += Clock::now() - start;
+        }
+    } else if (not finishRequested_) {
+        const auto start = Clock::now();
+        finishRequested_ = drain(sliceBudget_, sliceTimeBudget_);
+        stats_.markTime_ += Clock::now() - start;
+    }
+}
+
+void IncrementalMarkCompact::finish(Environment& env, Heap& heap)
+{
+    // Values referenced only by the roots may have been stored there after
+    // the roots were first scanned, so the roots need to be scanned again.
+    // Frames don't have a write barrier on the call stack, so they need to
+    // be visited again too.
+    mark(env);
+    marking_ = false;
+    finishRequested_ = false;
+    compact(env, heap);
+    endCycle(env, heap);
+    // Start the next cycle after half of the remaining space is used up.
+    trigger_ = footprint(heap) + (capacity(heap) - footprint(heap)) / 2;
+}
+
+void IncrementalMarkCompact::run(Environment& env, Heap& heap)
+{
+    if (marking_) {
+        finish(env, heap);
+    } else {
+        MarkCompact::run(env, heap);
+        trigger_ = footprint(heap) + (capacity(heap) - footprint(heap)) / 2;
+    }
 }
 
 } // namespace ebl
@@ -1,24 +1,269 @@
 #pragma once
 
+#include "gcWorkers.hpp"
+#include "markBitmap.hpp"
 #include "memory.hpp"
+#include "pageSpace.hpp"
+#include "region.hpp"
+#include "spinlock.hpp"
+#include "types.hpp"
+#include <array>
+#include <chrono>
+#include <memory>
+#include <set>
+#include <vector>
 
 namespace ebl {
 
+class Context;
 class Environment;
 
+// Metrics recorded for each collection, see Context::gcHistory().
+struct GCStats {
+    size_t sequence_; // The nth collection run by the context
+    std::chrono::system_clock::time_point finished_;
+    std::chrono::nanoseconds markTime_;
+    std::chrono::nanoseconds compactTime_;
+    size_t bytesReclaimed_;
+    size_t finalized_;
+    size_t bytesLive_;
+    size_t breaks_;
+    size_t persistentsScanned_;
+    bool incremental_;
+    std::array<size_t, typeCount> liveObjects_; // Indexed by TypeId
+};
+
+// A fixed size ring buffer of the most recent collections.
+class GCHistory {
+public:
+    static constexpr const size_t capacity = 64;
+
+    void record(const GCStats& stats)
+    {
+        entries_[total_ % capacity] = stats;
+        entries_[total_ % capacity].sequence_ = total_;
+        ++total_;
+    }
+
+    // Number of collections currently held in the buffer.
+    size_t size() const
+    {
+        return total_ < capacity ? total_ : capacity;
+    }
+
+    // Number of collections recorded since the context was created.
+    size_t total() const
+    {
+        return total_;
+    }
+
+    // Zero is the most recent collection.
+    const GCStats& operator[](size_t age) const
+    {
+        return entries_[(total_ - 1 - age) % capacity];
+    }
+
+private:
+    std::array<GCStats, capacity> entries_;
+    size_t total_ = 0;
+};
+
 class GC {
 public:
     virtual void run(Environment& env, Heap& heap) = 0;
+
+    // Moves the values in the context's open region that are still
+    // reachable into the heap, see Context::closeRegion(). Returns the
+    // number of bytes moved, which end up at the top of the heap.
+    virtual size_t evacuate(Environment& env, Heap& heap) = 0;
     virtual ~GC()
     {
     }
 };
 
+struct Forwarding;
+
 class MarkCompact : public GC {
 public:
+    // The collector sweeps the page space, if there is one, along with
+    // compacting the heap, see Context::Configuration::heapLayout_. With
+    // more than one thread, marking and compaction run in parallel, see
+    // drainParallel() and slide(). Values in the region, while it's open,
+    // are roots, and never move.
+    MarkCompact(const Heap& heap, PageSpace* pages = nullptr,
+                Region* region = nullptr, size_t threads = 1)
+        : pages_(pages), region_(region), marks_(heap),
+          workers_(threads > 1 ? new GCWorkers(threads) : nullptr)
+    {
+    }
+
     void run(Environment& env, Heap& heap) override;
+    size_t evacuate(Environment& env, Heap& heap) override;
     void mark(Environment& env);
     void compact(Environment& env, Heap& heap);
+
+protected:
+    // Marking is driven by an explicit gray stack rather than by recursion,
+    // so that long lists don't overflow the native stack, and so that the
+    // incremental collector can pause marking partway through.
+    void shade(ValuePtr val);
+
+    // Returns whether the value was already marked.
+    bool testAndMark(Value* val)
+    {
+        if (marks_.contains(val)) {
+            return marks_.testAndMark(val, valueSize(val));
+        }
+        if (pages_ and pages_->contains(val)) {
+            return pages_->testAndMark(val);
+        }
+        // Values in an open region are always live. Nothing else lives
+        // outside of the collected spaces, so there are no interior values
+        // to mark, and dead values are discarded without being read.
+        return true;
+    }
+
+    // As testAndMark(), but safe to call from several threads at once.
+    bool testAndMarkShared(Value* val);
+
+    bool marked(Value* val) const
+    {
+        if (marks_.contains(val)) {
+            return marks_.marked(val);
+        }
+        if (pages_ and pages_->contains(val)) {
+            return pages_->marked(val);
+        }
+        return true;
+    }
+
+    // Bytes in use and total capacity, across the heap and the page space.
+    size_t footprint(const Heap& heap) const;
+    size_t capacity(const Heap& heap) const;
+
+    // Calls visit on each root, and on the variables of the frames on the
+    // call stack. Returns the number of persistents visited.
+    template <typename F> size_t visitRoots(Environment& env, F&& visit);
+
+    void markRoots(Environment& env);
+    void traceFrames(Environment& frame);
+
+    // Calls visit on each value that val references, including the
+    // variables of the frames captured by a function.
+    template <typename F> void trace(ValuePtr val, F&& visit);
+    template <typename F> void traceFrames(Environment& frame, F&& visit);
+
+    // Returns true once the gray stack is empty. A budget of zero means no
+    // limit.
+    bool drain(size_t budget, std::chrono::microseconds timeBudget);
+
+    // Empties the gray stack with all of the workers.
+    void drainParallel();
+
+    void remapRoots(Context& context, const Forwarding& forwarding,
+                    std::set<Environment*>& frames);
+
+    // Moves the live values in the heap to their forwarding addresses.
+    void slide(Heap& heap, const Forwarding& forwarding,
+               std::set<Environment*>& frames);
+
+    void finalize(Environment& env);
+
+    // The symbol table doesn't keep symbols alive, so unmarked symbols are
+    // removed from it before compaction.
+    void sweepSymbols(Environment& env);
+
+    void beginCycle();
+    void endCycle(Environment& env, Heap& heap);
+
+    PageSpace* const pages_;
+    Region* const region_;
+    MarkBitmap marks_;
+    std::unique_ptr<GCWorkers> workers_;
+    std::vector<ValuePtr> grayStack_;
+    GCStats stats_;
+    size_t epoch_ = 0;
+};
+
+// IncrementalMarkCompact splits the mark phase into bounded slices,
+// interleaved with allocation. Values allocated during a cycle are allocated
+// black, and stores into existing values while marking go through
+// writeBarrier(), which shades the stored value (i.e. a Dijkstra-style
+// insertion barrier). Roots are re-scanned in the final pause, and compaction
+// only happens at the end of a cycle, so no value moves while the mutator is
+// running between slices. Slices mark on the allocating thread, and only the
+// final pause uses the collector's other threads.
+class IncrementalMarkCompact : public MarkCompact {
+public:
+    IncrementalMarkCompact(const Heap& heap, PageSpace* pages,
+                           Region* region, size_t threads,
+                           size_t sliceBudget,
+                           std::chrono::microseconds sliceTimeBudget)
+        : MarkCompact(heap, pages, region, threads), sliceBudget_(sliceBudget),
+          sliceTimeBudget_(sliceTimeBudget)
+    {
+    }
+
+    void run(Environment& env, Heap& heap) override;
+
+    // Called by the allocator before each allocation of size bytes. Starts
+    // a cycle or performs a mark slice, depending on allocation progress. A
+    // slice never moves values.
+    void step(Environment& env, Heap& heap, size_t bytes);
+
+    // Called by the allocator after constructing a value.
+    void allocated(ValuePtr val)
+    {
+        if (marking_) {
+            testAndMark(val.get());
+            switch (val->typeId()) {
+            case typeId<Pair>():
+            case typeId<Function>():
+            case typeId<Symbol>():
+            case typeId<Box>():
+                // The new value is black, but the values that it was
+                // constructed from, or a function's definition environment,
+                // may not have been traced yet, and might not be reachable
+                // from anywhere else by the end of the cycle.
+                grayStack_.push_back(val);
+                break;
+            }
+        }
+    }
+
+    inline void writeBarrier(ValuePtr val)
+    {
+        if (UNLIKELY(marking_)) {
+            shade(val);
+        }
+    }
+
+    bool marking() const
+    {
+        return marking_;
+    }
+
+    // Once marking work runs out, the cycle needs a final pause, which
+    // re-scans the roots and compacts the heap. The final pause may move
+    // values, so it only runs at safepoints where the VM holds no references
+    // outside of the roots, see Context::safepoint(). A native function that
+    // calls back into bytecode, like apply, passes through safepoints too,
+    // so like an allocation, the call may move any value that the native
+    // function isn't holding in a Handle.
+    bool finishRequested() const
+    {
+        return finishRequested_;
+    }
+
+    void finish(Environment& env, Heap& heap);
+
+private:
+    const size_t sliceBudget_;
+    const std::chrono::microseconds sliceTimeBudget_;
+    size_t allocatedSinceSlice_ = 0;
+    size_t trigger_ = 0;
+    bool marking_ = false;
+    bool finishRequested_ = false;
 };
 
 } // namespace ebl
@@ -0,0 +1,61 @@
+#include "gcWorkers.hpp"
+
+namespace ebl {
+
+GCWorkers::GCWorkers(size_t count)
+{
+    for (size_t worker = 1; worker < count; ++worker) {
+        threads_.emplace_back([this, worker] { loop(worker); });
+    }
+}
+
+GCWorkers::~GCWorkers()
+{
+    {
+        std::lock_guard<std::mutex> guard(mutex_);
+        exit_ = true;
+    }
+    start_.notify_all();
+    for (auto& thread : threads_) {
+        thread.join();
+    }
+}
+
+void GCWorkers::run(const Job& job)
+{
+    {
+        std::lock_guard<std::mutex> guard(mutex_);
+        job_ = &job;
+        running_ = threads_.size();
+        ++generation_;
+    }
+    start_.notify_all();
+    job(0);
+    std::unique_lock<std::mutex> lock(mutex_);
+    finished_.wait(lock, [this] { return running_ == 0; });
+    job_ = nullptr;
+}
+
+void GCWorkers::loop(size_t worker)
+{
+    size_t seen = 0;
+    while (true) {
+        const Job* job;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            start_.wait(lock, [&] { return exit_ or generation_ not_eq seen; });
+            if (exit_) {
+                return;
+            }
+            seen = generation_;
+            job = job_;
+        }
+        (*job)(worker);
+        std::lock_guard<std::mutex> guard(mutex_);
+        if (--running_ == 0) {
+            finished_.notify_one();
+        }
+    }
+}
+
+} // namespace ebl
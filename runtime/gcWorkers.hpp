@@ -0,0 +1,43 @@
+#pragma once
+
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace ebl {
+
+// A pool of threads for the collector's parallel phases. The threads sleep
+// between collections. The thread calling run() takes part as worker zero.
+class GCWorkers {
+public:
+    using Job = std::function<void(size_t worker)>;
+
+    GCWorkers(size_t count);
+    GCWorkers(const GCWorkers&) = delete;
+    ~GCWorkers();
+
+    // Number of workers, including the calling thread.
+    size_t count() const
+    {
+        return threads_.size() + 1;
+    }
+
+    // Calls job on every worker, and returns once they've all finished.
+    void run(const Job& job);
+
+private:
+    void loop(size_t worker);
+
+    std::vector<std::thread> threads_;
+    std::mutex mutex_;
+    std::condition_variable start_;
+    std::condition_variable finished_;
+    const Job* job_ = nullptr;
+    size_t generation_ = 0;
+    size_t running_ = 0;
+    bool exit_ = false;
+};
+
+} // namespace ebl
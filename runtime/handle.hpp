@@ -0,0 +1,197 @@
+#pragma once
+
+#include "types.hpp"
+#include <stdexcept>
+#include <vector>
+
+// Handles keep values referenced from C++ locals alive, and up to date, across
+// collections. Each handle is a slot in a contiguous per-context stack of
+// roots, so creating one is a pointer bump, and a HandleScope releases every
+// handle created within it at once when it goes out of scope. The collector
+// scans (and remaps) the live part of the stack as a single array.
+//
+// The vm opens a scope around each call into a native function, so wrapped
+// CFunctions may create handles freely. Code that creates handles in a loop
+// should open its own scope inside the loop body, or, if it needs to keep all
+// of the values, collect them in a HandleBuffer. A Handle must not outlive
+// the scope that was active when it was created, use a Persistent for values
+// that need to stay rooted independently of the native call stack.
+
+namespace ebl {
+
+class Environment;
+
+class HandleStack {
+public:
+    HandleStack(size_t capacity)
+    {
+        slots_.reserve(capacity);
+    }
+
+    HandleStack(const HandleStack&) = delete;
+
+    // The slots never reallocate, so the returned pointer stays valid until
+    // the slot is released.
+    ValuePtr* push(ValuePtr val)
+    {
+        if (UNLIKELY(slots_.size() == slots_.capacity())) {
+            throw std::runtime_error("handle stack exhausted");
+        }
+        slots_.push_back(val);
+        return &slots_.back();
+    }
+
+    size_t top() const
+    {
+        return slots_.size();
+    }
+
+    void release(size_t top)
+    {
+        slots_.erase(slots_.begin() + top, slots_.end());
+    }
+
+    // For the collector, calls visit on every handle slot, and on every
+    // value in a registered HandleBuffer.
+    template <typename F> void forEach(F&& visit)
+    {
+        for (auto& val : slots_) {
+            visit(val);
+        }
+        for (auto buffer : buffers_) {
+            for (auto& val : *buffer) {
+                visit(val);
+            }
+        }
+    }
+
+    void registerBuffer(std::vector<ValuePtr>* buffer)
+    {
+        buffers_.push_back(buffer);
+    }
+
+    // Buffers are almost always released in the reverse of the order that
+    // they were registered in, so the search is short.
+    void unregisterBuffer(std::vector<ValuePtr>* buffer)
+    {
+        for (auto it = buffers_.rbegin(); it not_eq buffers_.rend(); ++it) {
+            if (*it == buffer) {
+                buffers_.erase(std::next(it).base());
+                return;
+            }
+        }
+    }
+
+private:
+    std::vector<ValuePtr> slots_;
+    std::vector<std::vector<ValuePtr>*> buffers_;
+};
+
+
+// A growable array of rooted values, for native code that holds on to an
+// unbounded number of values at once, like a list under construction, where
+// a Handle for each would exhaust the HandleStack. The collector scans (and
+// remaps) the buffer along with the handles, for as long as it exists.
+class HandleBuffer {
+public:
+    HandleBuffer(HandleStack& stack) : stack_(stack)
+    {
+        stack_.registerBuffer(&values_);
+    }
+
+    inline HandleBuffer(Environment& env);
+
+    HandleBuffer(const HandleBuffer&) = delete;
+    HandleBuffer& operator=(const HandleBuffer&) = delete;
+
+    ~HandleBuffer()
+    {
+        stack_.unregisterBuffer(&values_);
+    }
+
+    void push(ValuePtr val)
+    {
+        values_.push_back(val);
+    }
+
+    size_t size() const
+    {
+        return values_.size();
+    }
+
+    ValuePtr operator[](size_t index) const
+    {
+        return values_[index];
+    }
+
+private:
+    HandleStack& stack_;
+    std::vector<ValuePtr> values_;
+};
+
+
+class HandleScope {
+public:
+    HandleScope(HandleStack& stack) : stack_(stack), top_(stack.top())
+    {
+    }
+
+    inline HandleScope(Environment& env);
+
+    HandleScope(const HandleScope&) = delete;
+    HandleScope& operator=(const HandleScope&) = delete;
+
+    ~HandleScope()
+    {
+        stack_.release(top_);
+    }
+
+private:
+    HandleStack& stack_;
+    const size_t top_;
+};
+
+
+// Copies of a handle refer to the same slot.
+template <typename T> class Handle {
+public:
+    Handle(HandleStack& stack, Heap::Ptr<T> val) : slot_(stack.push(val))
+    {
+    }
+
+    inline Handle(Environment& env, Heap::Ptr<T> val);
+
+    Handle& operator=(Heap::Ptr<T> val)
+    {
+        *slot_ = val;
+        return *this;
+    }
+
+    T& operator*() const
+    {
+        return *slot_->template cast<T>().get();
+    }
+
+    T* operator->() const
+    {
+        return slot_->template cast<T>().get();
+    }
+
+    operator Heap::Ptr<T>() const
+    {
+        return slot_->template cast<T>();
+    }
+
+    // Environment::create() forwards its arguments by reference, so passing
+    // slot() rather than a copy of the pointer lets a constructor argument
+    // survive a collection triggered by the allocation.
+    const ValuePtr& slot() const
+    {
+        return *slot_;
+    }
+
+private:
+    ValuePtr* slot_;
+};
+
+} // namespace ebl
@@ -0,0 +1,230 @@
+#include "heapSnapshot.hpp"
+#include "environment.hpp"
+#include "persistent.hpp"
+#include <fstream>
+#include <unordered_set>
+
+namespace ebl {
+
+namespace {
+
+class SnapshotWriter {
+public:
+    SnapshotWriter(const std::string& fname)
+        : out_(fname, std::ofstream::binary)
+    {
+        if (not out_) {
+            throw std::runtime_error("failed to open " + fname);
+        }
+    }
+
+    template <typename T> void write(T val)
+    {
+        out_.write((const char*)&val, sizeof val);
+    }
+
+    void writeAddress(const void* address)
+    {
+        write<uint64_t>((uintptr_t)address);
+    }
+
+    void writeTypeNames()
+    {
+        write<uint32_t>(typeCount + 1);
+        for (size_t i = 0; i < typeCount; ++i) {
+            writeName(typeInfoTable.table[i].name_);
+        }
+        writeName("<Frame>");
+    }
+
+    // The node count isn't known until the heap has been walked, so it gets
+    // filled in afterwards.
+    void beginNodes()
+    {
+        nodeCountPos_ = out_.tellp();
+        write<uint64_t>(0);
+    }
+
+    void endNodes()
+    {
+        const auto pos = out_.tellp();
+        out_.seekp(nodeCountPos_);
+        write<uint64_t>(nodeCount_);
+        out_.seekp(pos);
+    }
+
+    void node(const void* address, uint8_t type, uint64_t size)
+    {
+        writeAddress(address);
+        write<uint8_t>(type);
+        write<uint64_t>(size);
+        write<uint32_t>(refs_.size());
+        for (auto ref : refs_) {
+            writeAddress(ref);
+        }
+        refs_.clear();
+        ++nodeCount_;
+    }
+
+    void ref(const void* address)
+    {
+        refs_.push_back(address);
+    }
+
+    void ref(ValuePtr val)
+    {
+        refs_.push_back(val.get());
+    }
+
+    void ref(Environment* frame)
+    {
+        refs_.push_back(frame);
+        enqueue(frame);
+    }
+
+    void enqueue(Environment* frame)
+    {
+        if (frames_.insert(frame).second) {
+            pendingFrames_.push_back(frame);
+        }
+    }
+
+    std::vector<Environment*>& pendingFrames()
+    {
+        return pendingFrames_;
+    }
+
+    void close()
+    {
+        out_.close();
+        if (not out_) {
+            throw std::runtime_error("failed to write heap snapshot");
+        }
+    }
+
+private:
+    void writeName(const char* name)
+    {
+        const uint32_t len = strlen(name);
+        write(len);
+        out_.write(name, len);
+    }
+
+    std::ofstream out_;
+    std::streampos nodeCountPos_;
+    uint64_t nodeCount_ = 0;
+    std::vector<const void*> refs_;
+    std::unordered_set<Environment*> frames_;
+    std::vector<Environment*> pendingFrames_;
+};
+
+} // namespace
+
+static void writeValue(SnapshotWriter& writer, Value* val)
+{
+    size_t size = valueSize(val);
+    switch (val->typeId()) {
+    case typeId<Pair>():
+        writer.ref(((Pair*)val)->getCar());
+        writer.ref(((Pair*)val)->getCdr());
+        break;
+
+    case typeId<Symbol>():
+        writer.ref(((Symbol*)val)->value());
+        break;
+
+    case typeId<Box>():
+        writer.ref(((Box*)val)->get());
+        break;
+
+    case typeId<Function>():
+        writer.ref(((Function*)val)->getDocstring());
+        writer.ref(((Function*)val)->definitionEnvironment().get());
+        break;
+
+    case typeId<String>():
+        size += ((String*)val)->storageSize();
+        break;
+
+    case typeId<StringBuilder>():
+        size += ((StringBuilder*)val)->bytes();
+        break;
+    }
+    writer.node(val, val->typeId(), size);
+}
+
+void Context::writeHeapSnapshot(const std::string& fname)
+{
+    using snapshot::RootKind;
+
+    SnapshotWriter writer(fname);
+    for (char c : snapshot::magic) {
+        writer.write(c);
+    }
+    writer.writeTypeNames();
+
+    writer.beginNodes();
+    size_t index = 0;
+    while (index < heap_.size()) {
+        auto current = (Value*)(heap_.begin() + index);
+        writeValue(writer, current);
+        index += valueSize(current);
+    }
+    if (pages_) {
+        pages_->forEachLive([&](Value* val) { writeValue(writer, val); });
+    }
+    // Only frames reachable from the roots or from a function are known, so
+    // they're registered before the nodes are finished.
+    writer.enqueue(topLevel_.get());
+    for (auto& frameInfo : callStack_) {
+        writer.enqueue(frameInfo.env_.get());
+    }
+    auto& frames = writer.pendingFrames();
+    std::vector<Environment*> visiting;
+    while (not frames.empty()) {
+        visiting.swap(frames);
+        for (auto frame : visiting) {
+            for (auto& val : frame->getVars()) {
+                writer.ref(val);
+            }
+            if (auto parent = frame->parent()) {
+                writer.ref(parent.get());
+            }
+            writer.node(frame, typeCount, sizeof(Environment));
+        }
+        visiting.clear();
+    }
+    writer.endNodes();
+
+    std::vector<std::pair<RootKind, const void*>> roots;
+    roots.push_back({RootKind::topLevel, topLevel_.get()});
+    for (auto& frameInfo : callStack_) {
+        roots.push_back({RootKind::callStack, frameInfo.env_.get()});
+    }
+    for (auto& val : immediates_) {
+        roots.push_back({RootKind::immediates, val.get()});
+    }
+    for (auto& val : operandStack_) {
+        roots.push_back({RootKind::operandStack, val.get()});
+    }
+    handles_.forEach([&](ValuePtr val) {
+        roots.push_back({RootKind::handles, val.get()});
+    });
+    for (auto p = persistentsList_; p; p = p->next()) {
+        roots.push_back({RootKind::persistents, p->getUntypedVal().get()});
+    }
+    roots.push_back({RootKind::constants, booleans_[0].get()});
+    roots.push_back({RootKind::constants, booleans_[1].get()});
+    roots.push_back({RootKind::constants, nullValue_.get()});
+    for (auto& c : asciiCharacters_) {
+        roots.push_back({RootKind::constants, c.get()});
+    }
+    writer.write<uint64_t>(roots.size());
+    for (auto& root : roots) {
+        writer.write<uint8_t>((uint8_t)root.first);
+        writer.writeAddress(root.second);
+    }
+    writer.close();
+}
+
+} // namespace ebl
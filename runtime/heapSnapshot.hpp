@@ -0,0 +1,66 @@
+#pragma once
+
+#include <stdint.h>
+
+// Heap snapshot file format, written by Context::writeHeapSnapshot() and read
+// by ebl-heap-analyze. All integers are in host byte order.
+//
+//   magic       char[8]
+//   typeCount   uint32, followed by typeCount names, each a uint32 length
+//               and then the characters. Environment frames aren't heap
+//               values, but they hold references, so they appear in the
+//               snapshot too, with the last type id.
+//   nodeCount   uint64, followed by nodeCount nodes:
+//                 address   uint64
+//                 type      uint8
+//                 size      uint64, including memory owned outside the heap
+//                 refCount  uint32, followed by refCount addresses (uint64)
+//   rootCount   uint64, followed by rootCount roots:
+//                 kind      uint8, see RootKind
+//                 address   uint64
+//
+// The snapshot includes values that are no longer reachable but haven't been
+// collected yet. References may point to addresses that aren't nodes, e.g. a
+// character belonging to a string.
+
+namespace ebl {
+namespace snapshot {
+
+static const char magic[8] = {'E', 'B', 'L', 'H', 'E', 'A', 'P', '1'};
+
+enum class RootKind : uint8_t {
+    topLevel,
+    callStack,
+    immediates,
+    operandStack,
+    handles,
+    persistents,
+    constants,
+    count
+};
+
+inline const char* rootKindName(RootKind kind)
+{
+    switch (kind) {
+    case RootKind::topLevel:
+        return "top-level";
+    case RootKind::callStack:
+        return "call-stack";
+    case RootKind::immediates:
+        return "immediates";
+    case RootKind::operandStack:
+        return "operand-stack";
+    case RootKind::handles:
+        return "handles";
+    case RootKind::persistents:
+        return "persistents";
+    case RootKind::constants:
+        return "constants";
+    case RootKind::count:
+        break;
+    }
+    return "unknown";
+}
+
+} // namespace snapshot
+} // namespace ebl
@@ -1,7 +1,29 @@
 #include "lexer.hpp"
+#include "numbers.hpp"
+#include <limits>
 #include <stdexcept>
 
 namespace ebl {
+int32_t Lexer::integerValue() const
+{
+    const char* const end = inputBuffer_.data() + inputBuffer_.size();
+    long long value;
+    if (parseInteger(inputBuffer_.data(), end, value) not_eq end or
+        value > std::numeric_limits<int32_t>::max()) {
+        throw std::runtime_error("integer literal out of range: " +
+                                 inputBuffer_);
+    }
+    return value;
+}
+
+double Lexer::floatValue() const
+{
+    double value;
+    parseFloat(inputBuffer_.data(), inputBuffer_.data() + inputBuffer_.size(),
+               value);
+    return value;
+}
+
 Lexer::Token Lexer::lex()
 {
     if (position_ < input_.size()) {
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <stdint.h>
 #include <string>
 
 namespace ebl {
@@ -35,6 +36,10 @@ public:
         return inputBuffer_;
     }
 
+    // The value of the INTEGER or FLOAT token that was just lexed.
+    int32_t integerValue() const;
+    double floatValue() const;
+
     std::string remaining() const
     {
         return input_.substr(position_);
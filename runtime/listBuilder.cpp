@@ -4,29 +4,30 @@
 namespace ebl {
 
 ListBuilder::ListBuilder(Environment& env, ValuePtr first)
-    : env_(env), front_(env, env.create<Pair>(first, env.getNull())),
-      back_((Heap::Ptr<Pair>)front_)
+    : env_(env), front_(env), back_(env)
 {
+    pushBack(first);
 }
 
 
 void ListBuilder::pushFront(ValuePtr value)
 {
-    front_ = env_.create<Pair>(value, (Heap::Ptr<Pair>)front_);
+    front_.push(value);
 }
 
 
 void ListBuilder::pushBack(ValuePtr value)
 {
-    auto next = env_.create<Pair>(value, env_.getNull());
-    back_->setCdr(next);
-    back_ = next;
+    back_.push(value);
 }
 
 
 ValuePtr ListBuilder::result()
 {
-    return (Heap::Ptr<Pair>)front_;
+    const size_t fronts = front_.size();
+    return env_.createList(fronts + back_.size(), [&](size_t i) {
+        return i < fronts ? front_[fronts - 1 - i] : back_[i - fronts];
+    });
 }
 
 
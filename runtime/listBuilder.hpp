@@ -4,25 +4,31 @@
 #include "../extlib/optional.hpp"
 #include "../extlib/smallVector.hpp"
 
-#include "persistent.hpp"
+#include "handle.hpp"
 #include "types.hpp"
+#include <vector>
 
 
 namespace ebl {
 
 class Environment;
 
+// ListBuilder roots the elements in HandleBuffers, so lists of any length can
+// be built, and allocates the list all at once, as a cdr-coded run of Pairs,
+// when the result is requested.
 class ListBuilder {
 public:
     ListBuilder(Environment& env, ValuePtr first);
+    ListBuilder(const ListBuilder&) = delete;
     void pushFront(ValuePtr value);
     void pushBack(ValuePtr value);
     ValuePtr result();
 
 private:
     Environment& env_;
-    Persistent<Pair> front_;
-    Heap::Ptr<Pair> back_;
+    // The front elements are in reverse order.
+    HandleBuffer front_;
+    HandleBuffer back_;
 };
 
 
@@ -1,7 +1,9 @@
 #ifdef __GNUC__
 #define LIKELY(COND) __builtin_expect(COND, true)
 #define UNLIKELY(COND) __builtin_expect(COND, false)
+#define NOINLINE __attribute__((noinline))
 #else
 #define LIKELY(COND) COND
 #define UNLIKELY(COND) COND
+#define NOINLINE
 #endif
@@ -0,0 +1,188 @@
+#pragma once
+
+#include "memory.hpp"
+#include <algorithm>
+#include <vector>
+
+namespace ebl {
+
+// MarkBitmap holds the collector's mark bits for the compacted heap, so that
+// marking never writes to the values themselves. There's one bit per eight
+// byte granule, and marking a value sets the bits of every granule it
+// occupies, so each run of set bits is a run of live bytes. Compaction can
+// then skip over dead values without reading them, and compute a value's
+// new address directly: computeForwarding() counts the live granules before
+// each 64 granule block, and forward() adds the live granules before the
+// value within its block.
+class MarkBitmap {
+public:
+    static constexpr const size_t granule = Heap::Align;
+
+    MarkBitmap(const Heap& heap)
+        : begin_(heap.begin()), end_(heap.begin() + heap.capacity()),
+          bits_(heap.capacity() / granule / 64 + 1),
+          liveBefore_(bits_.size())
+    {
+    }
+
+    bool contains(const void* address) const
+    {
+        return address >= begin_ and address < end_;
+    }
+
+    // Marks the size bytes at address, returning whether the value there
+    // was already marked.
+    bool testAndMark(const void* address, size_t size)
+    {
+        const size_t first = bitIndex(address);
+        if (test(first)) {
+            return true;
+        }
+        setRange(first, size / granule);
+        return false;
+    }
+
+    // As testAndMark(), but safe to call from several threads at once. Of
+    // the threads marking the same value, exactly one sees it unmarked.
+    bool testAndMarkShared(const void* address, size_t size)
+    {
+        size_t first = bitIndex(address);
+        size_t count = size / granule;
+        const uint64_t start = uint64_t(1) << (first % 64);
+        bool leading = true;
+        while (count) {
+            const size_t shift = first % 64;
+            const size_t n = std::min(count, 64 - shift);
+            const uint64_t old = __atomic_fetch_or(
+                &bits_[first / 64], runMask(n) << shift, __ATOMIC_RELAXED);
+            if (leading and (old & start)) {
+                return true;
+            }
+            leading = false;
+            first += n;
+            count -= n;
+        }
+        return false;
+    }
+
+    bool marked(const void* address) const
+    {
+        return test(bitIndex(address));
+    }
+
+    // Returns the offset of the first byte at or after offset that begins a
+    // run of marked bytes, i.e. that begins a live value, or limit.
+    size_t nextRun(size_t offset, size_t limit) const
+    {
+        size_t word = offset / granule / 64;
+        uint64_t clear =
+            ~bits_[word] & (~uint64_t(0) << (offset / granule % 64));
+        while (not clear) {
+            if (++word * 64 * granule >= limit) {
+                return limit;
+            }
+            clear = ~bits_[word];
+        }
+        return nextMarked(std::min((word * 64 + ctz(clear)) * granule, limit),
+                          limit);
+    }
+
+    // Returns the offset of the first marked byte at or after offset, or
+    // limit, if there isn't one before limit.
+    size_t nextMarked(size_t offset, size_t limit) const
+    {
+        size_t word = offset / granule / 64;
+        uint64_t bits = bits_[word] & (~uint64_t(0) << (offset / granule % 64));
+        while (not bits) {
+            if (++word * 64 * granule >= limit) {
+                return limit;
+            }
+            bits = bits_[word];
+        }
+        return std::min((word * 64 + ctz(bits)) * granule, limit);
+    }
+
+    // Prepares forward() for the first bytes of the heap, returning the
+    // number of those bytes that are marked.
+    size_t computeForwarding(size_t bytes)
+    {
+        const size_t words = wordsCovering(bytes);
+        size_t live = 0;
+        for (size_t i = 0; i < words; ++i) {
+            liveBefore_[i] = live;
+            live += popcount(bits_[i]);
+        }
+        return live * granule;
+    }
+
+    // Where a marked value at address ends up once the heap is compacted.
+    uint8_t* forward(const void* address) const
+    {
+        return begin_ + liveBytesBefore(address);
+    }
+
+    // The number of marked bytes below address.
+    size_t liveBytesBefore(const void* address) const
+    {
+        const size_t bit = bitIndex(address);
+        const uint64_t below = (uint64_t(1) << (bit % 64)) - 1;
+        return (liveBefore_[bit / 64] + popcount(bits_[bit / 64] & below)) *
+               granule;
+    }
+
+    // Clears the marks for the first bytes of the heap.
+    void clear(size_t bytes)
+    {
+        std::fill(bits_.begin(), bits_.begin() + wordsCovering(bytes), 0);
+    }
+
+private:
+    static size_t ctz(uint64_t bits)
+    {
+        return __builtin_ctzll(bits);
+    }
+
+    static size_t popcount(uint64_t bits)
+    {
+        return __builtin_popcountll(bits);
+    }
+
+    static size_t wordsCovering(size_t bytes)
+    {
+        return (bytes / granule + 63) / 64;
+    }
+
+    size_t bitIndex(const void* address) const
+    {
+        return ((const uint8_t*)address - begin_) / granule;
+    }
+
+    bool test(size_t bit) const
+    {
+        return __atomic_load_n(&bits_[bit / 64], __ATOMIC_RELAXED) &
+               (uint64_t(1) << (bit % 64));
+    }
+
+    static uint64_t runMask(size_t n)
+    {
+        return n == 64 ? ~uint64_t(0) : (uint64_t(1) << n) - 1;
+    }
+
+    void setRange(size_t first, size_t count)
+    {
+        while (count) {
+            const size_t shift = first % 64;
+            const size_t n = std::min(count, 64 - shift);
+            bits_[first / 64] |= runMask(n) << shift;
+            first += n;
+            count -= n;
+        }
+    }
+
+    uint8_t* const begin_;
+    uint8_t* const end_;
+    std::vector<uint64_t> bits_;
+    std::vector<size_t> liveBefore_;
+};
+
+} // namespace ebl
@@ -1,6 +1,175 @@
 #include "memory.hpp"
 #include "environment.hpp"
 
+#if defined(__unix__) or defined(__APPLE__)
+#include <sys/mman.h>
+#include <unistd.h>
+#define EBL_MMAP
+#endif
+
+#ifdef EBL_COMPRESSED_REFS
+#ifndef EBL_MMAP
+#error "compressed references need mmap"
+#endif
+#include <map>
+#include <mutex>
+#endif
+
 namespace ebl {
 
+// Transparent huge pages only pay off when a heap spans several of them.
+static const size_t hugePageThreshold = 8 * 2 * 1024 * 1024;
+
+size_t pageSize()
+{
+#ifdef EBL_MMAP
+    static const size_t size = sysconf(_SC_PAGESIZE);
+    return size;
+#else
+    return 4096;
+#endif
+}
+
+#ifdef EBL_COMPRESSED_REFS
+
+uint8_t* cageBase = nullptr;
+
+namespace {
+
+// The cage is reserved without any access, so that it doesn't count against
+// the system's commit limit, and ranges are made accessible as they're
+// handed out. Free ranges are kept by offset, and coalesced on release.
+class Cage {
+public:
+    static constexpr const size_t size = (size_t(1) << 32) * 8;
+
+    Cage()
+    {
+        void* mem = mmap(nullptr, size, PROT_NONE,
+                         MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (mem == MAP_FAILED) {
+            throw std::runtime_error("failed to reserve the heap cage");
+        }
+        cageBase = (uint8_t*)mem;
+        // The first page is never handed out, so no value has an offset of
+        // zero.
+        free_[pageSize()] = size - pageSize();
+    }
+
+    void* map(size_t bytes)
+    {
+        bytes = roundUp(bytes);
+        std::lock_guard<std::mutex> guard(lock_);
+        for (auto range = free_.begin(); range not_eq free_.end(); ++range) {
+            if (range->second >= bytes) {
+                const size_t offset = range->first;
+                const size_t remaining = range->second - bytes;
+                free_.erase(range);
+                if (remaining) {
+                    free_[offset + bytes] = remaining;
+                }
+                if (mprotect(cageBase + offset, bytes,
+                             PROT_READ | PROT_WRITE) not_eq 0) {
+                    free_[offset] = bytes;
+                    return nullptr;
+                }
+                return cageBase + offset;
+            }
+        }
+        return nullptr;
+    }
+
+    void unmap(void* address, size_t bytes)
+    {
+        bytes = roundUp(bytes);
+        madvise(address, bytes, MADV_DONTNEED);
+        mprotect(address, bytes, PROT_NONE);
+        std::lock_guard<std::mutex> guard(lock_);
+        size_t offset = (uint8_t*)address - cageBase;
+        auto next = free_.lower_bound(offset);
+        if (next not_eq free_.end() and next->first == offset + bytes) {
+            bytes += next->second;
+            next = free_.erase(next);
+        }
+        if (next not_eq free_.begin()) {
+            auto prev = std::prev(next);
+            if (prev->first + prev->second == offset) {
+                offset = prev->first;
+                bytes += prev->second;
+            }
+        }
+        free_[offset] = bytes;
+    }
+
+private:
+    static size_t roundUp(size_t bytes)
+    {
+        return (bytes + pageSize() - 1) & ~(pageSize() - 1);
+    }
+
+    std::mutex lock_;
+    std::map<size_t, size_t> free_;
+};
+
+Cage& cage()
+{
+    static Cage instance;
+    return instance;
+}
+
+} // namespace
+
+#endif // EBL_COMPRESSED_REFS
+
+void* mapPages(size_t bytes, bool hugePages)
+{
+#if defined(EBL_COMPRESSED_REFS)
+    void* mem = cage().map(bytes);
+    if (not mem) {
+        return nullptr;
+    }
+#elif defined(EBL_MMAP)
+    void* mem = mmap(nullptr, bytes, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mem == MAP_FAILED) {
+        return nullptr;
+    }
+#endif
+#ifdef EBL_MMAP
+#ifdef MADV_HUGEPAGE
+    if (hugePages and bytes >= hugePageThreshold) {
+        // Only advice, the kernel may not have huge pages enabled.
+        madvise(mem, bytes, MADV_HUGEPAGE);
+    }
+#endif
+    return mem;
+#else
+    return calloc(bytes, 1);
+#endif
+}
+
+void unmapPages(void* address, size_t bytes)
+{
+#if defined(EBL_COMPRESSED_REFS)
+    if (address) {
+        cage().unmap(address, bytes);
+    }
+#elif defined(EBL_MMAP)
+    if (address) {
+        munmap(address, bytes);
+    }
+#else
+    free(address);
+#endif
+}
+
+void releasePages(void* address, size_t bytes)
+{
+#ifdef EBL_MMAP
+    // For private anonymous mappings, MADV_DONTNEED drops the pages
+    // immediately, and they come back zero filled.
+    madvise(address, bytes, MADV_DONTNEED);
+#endif
+}
+
 } // namespace ebl
@@ -1,5 +1,6 @@
 #pragma once
 
+#include "macros.hpp"
 #include <cstring>
 #include <stddef.h>
 #include <stdexcept>
@@ -12,6 +13,32 @@ namespace ebl {
 
 class Environment;
 
+// Page mapping primitives for large, long lived Memory instances, like the
+// heap. On systems without mmap, mapPages() falls back to a zeroed malloc,
+// and releasePages() does nothing.
+void* mapPages(size_t bytes, bool hugePages);
+void unmapPages(void* address, size_t bytes);
+void releasePages(void* address, size_t bytes);
+size_t pageSize();
+
+#ifdef EBL_COMPRESSED_REFS
+// With compressed references, all mapped memory is carved out of a single
+// reservation, the cage, so that any value in the heap, the page space, or
+// a region can be addressed by a 32 bit count of eight byte granules from
+// the cage's base.
+extern uint8_t* cageBase;
+
+inline uint32_t compressAddress(const void* address)
+{
+    return ((const uint8_t*)address - cageBase) / 8;
+}
+
+inline uint8_t* expandAddress(uint32_t offset)
+{
+    return cageBase + size_t(offset) * 8;
+}
+#endif
+
 template <size_t Alignment> class Memory {
 public:
     static constexpr const size_t Align = Alignment;
@@ -27,38 +54,61 @@ public:
         std::memset(begin_, initialValue, capacity_);
     }
 
-    Memory() : begin_(nullptr), end_(nullptr), capacity_(0)
+    // Mapped memory comes straight from the operating system, zero filled,
+    // and only becomes resident as it's touched, so that a large heap
+    // doesn't cost anything until it's used, and its unused tail can be
+    // given back with release().
+    struct Mapped {
+        bool hugePages_;
+    };
+
+    Memory(size_t capacity, Mapped options)
+    {
+        checkAlignment(capacity);
+        capacity_ = capacity;
+        begin_ = (uint8_t*)mapPages(capacity, options.hugePages_);
+        if (not begin_) {
+            throw std::runtime_error("failed to allocate a heap");
+        }
+        end_ = begin_;
+        mapped_ = true;
+    }
+
+    Memory() : begin_(nullptr), end_(nullptr), capacity_(0), mapped_(false)
     {
     }
 
     Memory(const Memory&) = delete;
 
     Memory(Memory&& other)
-        : begin_(other.begin_), end_(other.end_), capacity_(other.capacity_)
+        : begin_(other.begin_), end_(other.end_), capacity_(other.capacity_),
+          mapped_(other.mapped_)
     {
         other.begin_ = nullptr;
         other.end_ = nullptr;
         other.capacity_ = 0;
+        other.mapped_ = false;
     }
 
     ~Memory()
     {
-        free(begin_);
+        if (mapped_) {
+            unmapPages(begin_, capacity_);
+        } else {
+            free(begin_);
+        }
     }
 
     void init(size_t capacity)
     {
-        if (capacity % Alignment not_eq 0) {
-            throw std::runtime_error("Allocation request does not satify"
-                                     " alignment requirement of " +
-                                     std::to_string(Alignment));
-        }
+        checkAlignment(capacity);
         capacity_ = capacity;
         begin_ = (uint8_t*)malloc(capacity);
         if (not begin_) {
             throw std::runtime_error("failed to allocate a heap");
         }
         end_ = begin_;
+        mapped_ = false;
     }
 
     template <typename T> class Ptr;
@@ -74,6 +124,41 @@ public:
 
     template <typename T> GenericPtr alloc();
 
+    // For runs of values allocated together, see Context::createList().
+    GenericPtr allocBytes(size_t bytes)
+    {
+        if (auto result = tryAllocBytes(bytes)) {
+            return {result};
+        }
+        throw OOM{};
+    }
+
+    // As alloc() and allocBytes(), but returning null when there isn't
+    // room, so that the allocation fast path can branch to a slow path
+    // rather than unwind, see Context::create().
+    template <typename T> uint8_t* tryAlloc()
+    {
+        static_assert(alignof(T) == Alignment, "Invalid alignment");
+        return tryAllocBytes(sizeof(T));
+    }
+
+    uint8_t* tryAllocBytes(size_t bytes)
+    {
+        if (LIKELY(bytes <= capacity_ - size())) {
+            auto result = end_;
+            end_ += bytes;
+            return result;
+        }
+        return nullptr;
+    }
+
+    // For values that live outside of any Memory instance, e.g. in a
+    // PageSpace.
+    static GenericPtr wrap(void* address)
+    {
+        return {(uint8_t*)address};
+    }
+
     template <typename T> Memory::Ptr<T> arrayElemAt(size_t index) const;
 
     void compacted(size_t bytes)
@@ -81,6 +166,24 @@ public:
         end_ -= bytes;
     }
 
+    // Returns the whole pages between end() and limit to the operating
+    // system. Nothing may live there, and the pages read as zero when
+    // they're next allocated. Returns the number of bytes released, always
+    // zero for memory that isn't mapped.
+    size_t release(uint8_t* limit)
+    {
+        const uintptr_t page = pageSize();
+        auto from = (uint8_t*)(((uintptr_t)end_ + page - 1) & ~(page - 1));
+        if (not mapped_ or limit <= from) {
+            return 0;
+        }
+        const size_t bytes = (limit - from) & ~(page - 1);
+        if (bytes) {
+            releasePages(from, bytes);
+        }
+        return bytes;
+    }
+
     size_t size() const
     {
         return end_ - begin_;
@@ -102,9 +205,19 @@ public:
     }
 
 private:
+    static void checkAlignment(size_t capacity)
+    {
+        if (capacity % Alignment not_eq 0) {
+            throw std::runtime_error("Allocation request does not satify"
+                                     " alignment requirement of " +
+                                     std::to_string(Alignment));
+        }
+    }
+
     uint8_t* begin_;
     uint8_t* end_;
     size_t capacity_;
+    bool mapped_;
 };
 
 
@@ -182,10 +295,7 @@ template <size_t Alignment>
 template <typename T>
 typename Memory<Alignment>::GenericPtr Memory<Alignment>::alloc()
 {
-    static_assert(alignof(T) == Alignment, "Invalid alignment");
-    if (this->size() + sizeof(T) <= capacity_) {
-        auto result = end_;
-        end_ += sizeof(T);
+    if (auto result = tryAlloc<T>()) {
         return {result};
     }
     throw OOM{};
@@ -201,4 +311,27 @@ Memory<Alignment>::arrayElemAt(size_t index) const
 
 using Heap = Memory<8>;
 
+// The type for references stored within values in the heap. When built
+// with EBL_COMPRESSED_REFS, a HeapRef holds a 32 bit offset into the cage
+// (see compressAddress()), converted to and from a Heap::Ptr on access, and
+// otherwise it's simply a Heap::Ptr.
+#ifdef EBL_COMPRESSED_REFS
+template <typename T> class HeapRef {
+public:
+    HeapRef(Heap::Ptr<T> ptr) : offset_(compressAddress(ptr.handle()))
+    {
+    }
+
+    operator Heap::Ptr<T>() const
+    {
+        return Heap::wrap(expandAddress(offset_)).template cast<T>();
+    }
+
+private:
+    uint32_t offset_;
+};
+#else
+template <typename T> using HeapRef = Heap::Ptr<T>;
+#endif
+
 } // namespace ebl
@@ -0,0 +1,434 @@
+#include "numbers.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+namespace ebl {
+
+static bool isDigit(char c)
+{
+    return c >= '0' and c <= '9';
+}
+
+// Returns the length of word, if the text at pos begins with it, ignoring
+// case, or zero.
+static size_t matchWord(const char* pos, const char* end, const char* word)
+{
+    size_t length = 0;
+    for (; word[length]; ++length) {
+        if (pos + length == end or (pos[length] | 0x20) not_eq word[length]) {
+            return 0;
+        }
+    }
+    return length;
+}
+
+const char* parseInteger(const char* begin, const char* end, long long& value)
+{
+    const char* pos = begin;
+    const bool negative = pos < end and *pos == '-';
+    if (negative) {
+        ++pos;
+    }
+    const char* digits = pos;
+    const unsigned long long limit =
+        negative ? 0 - (unsigned long long)INT64_MIN : INT64_MAX;
+    unsigned long long magnitude = 0;
+    for (; pos < end and isDigit(*pos); ++pos) {
+        const unsigned digit = *pos - '0';
+        if (magnitude > (limit - digit) / 10) {
+            return begin;
+        }
+        magnitude = magnitude * 10 + digit;
+    }
+    if (pos == digits) {
+        return begin;
+    }
+    value = negative ? (long long)(0 - magnitude) : (long long)magnitude;
+    return pos;
+}
+
+const char* parseFloat(const char* begin, const char* end, double& value)
+{
+    const char* pos = begin;
+    const bool negative = pos < end and *pos == '-';
+    if (negative) {
+        ++pos;
+    }
+    if (pos < end and not isDigit(*pos) and *pos not_eq '.') {
+        size_t length;
+        if ((length = matchWord(pos, end, "infinity")) or
+            (length = matchWord(pos, end, "inf"))) {
+            value = negative ? -HUGE_VAL : HUGE_VAL;
+            return pos + length;
+        }
+        if ((length = matchWord(pos, end, "nan"))) {
+            value = negative ? -NAN : NAN;
+            return pos + length;
+        }
+        return begin;
+    }
+
+    // The first nineteen significant digits fit in the mantissa. Any more
+    // are left out, and rounding is left to strtod().
+    uint64_t mantissa = 0;
+    int significant = 0;
+    int exponent = 0;
+    bool truncated = false;
+    bool anyDigits = false;
+    for (; pos < end and isDigit(*pos); ++pos) {
+        anyDigits = true;
+        if (significant < 19) {
+            mantissa = mantissa * 10 + (*pos - '0');
+            significant += mantissa not_eq 0;
+        } else {
+            truncated = true;
+            ++exponent;
+        }
+    }
+    if (pos < end and *pos == '.') {
+        for (++pos; pos < end and isDigit(*pos); ++pos) {
+            anyDigits = true;
+            if (significant < 19) {
+                mantissa = mantissa * 10 + (*pos - '0');
+                significant += mantissa not_eq 0;
+                --exponent;
+            } else {
+                truncated = true;
+            }
+        }
+    }
+    if (not anyDigits) {
+        return begin;
+    }
+    if (pos < end and (*pos == 'e' or *pos == 'E')) {
+        const char* marker = pos++;
+        const bool negativeExponent = pos < end and *pos == '-';
+        if (pos < end and (*pos == '-' or *pos == '+')) {
+            ++pos;
+        }
+        if (pos < end and isDigit(*pos)) {
+            int written = 0;
+            for (; pos < end and isDigit(*pos); ++pos) {
+                // Past this, the result is zero or infinite anyway.
+                if (written < 100000) {
+                    written = written * 10 + (*pos - '0');
+                }
+            }
+            exponent += negativeExponent ? -written : written;
+        } else {
+            pos = marker;
+        }
+    }
+
+    // When the mantissa and the power of ten are both exactly representable,
+    // a single multiplication or division rounds correctly (Clinger's fast
+    // path). That covers most numbers written by hand, or printed by
+    // formatFloat().
+    static const double powersOfTen[] = {
+        1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+        1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+    const uint64_t exactLimit = uint64_t(1) << 53;
+    if (not truncated and mantissa <= exactLimit and exponent >= -22 and
+        exponent <= 22) {
+        value = exponent < 0 ? double(mantissa) / powersOfTen[-exponent]
+                             : double(mantissa) * powersOfTen[exponent];
+        if (negative) {
+            value = -value;
+        }
+        return pos;
+    }
+
+    // Otherwise, strtod() does the rounding. It needs a terminated copy of
+    // the text, which usually fits on the stack.
+    const size_t length = pos - begin;
+    char local[64];
+    std::string spill;
+    const char* text = local;
+    if (length < sizeof local) {
+        std::copy(begin, pos, local);
+        local[length] = '\0';
+    } else {
+        spill.assign(begin, length);
+        text = spill.c_str();
+    }
+    value = strtod(text, nullptr);
+    return pos;
+}
+
+void formatInteger(std::string& out, long long value)
+{
+    char digits[24];
+    char* pos = digits + sizeof digits;
+    unsigned long long magnitude =
+        value < 0 ? 0 - (unsigned long long)value : value;
+    do {
+        *--pos = '0' + magnitude % 10;
+        magnitude /= 10;
+    } while (magnitude);
+    if (value < 0) {
+        *--pos = '-';
+    }
+    out.append(pos, digits + sizeof digits - pos);
+}
+
+// Shortest float printing, by Florian Loitsch's Grisu3, from "Printing
+// Floating-Point Numbers Quickly and Accurately with Integers". Grisu3 works
+// with 64 bit approximations of the value, and its neighbours, scaled by a
+// cached power of ten. It finds the shortest digits that lie strictly between
+// the neighbours, or, for about one value in two hundred, gives up because it
+// can't be sure of that, and printf() takes over.
+namespace {
+
+// A number f * 2^e.
+struct DiyFp {
+    uint64_t f_;
+    int e_;
+};
+
+struct CachedPower {
+    uint64_t significand_;
+    int16_t binaryExponent_;
+    int16_t decimalExponent_;
+};
+
+// The powers of ten from 10^-348 up to 10^340, in steps of 10^8, rounded to
+// 64 bit significands.
+const CachedPower cachedPowers[] = {
+    {0xfa8fd5a0081c0288ull, -1220, -348}, {0xbaaee17fa23ebf76ull, -1193, -340},
+    {0x8b16fb203055ac76ull, -1166, -332}, {0xcf42894a5dce35eaull, -1140, -324},
+    {0x9a6bb0aa55653b2dull, -1113, -316}, {0xe61acf033d1a45dfull, -1087, -308},
+    {0xab70fe17c79ac6caull, -1060, -300}, {0xff77b1fcbebcdc4full, -1034, -292},
+    {0xbe5691ef416bd60cull, -1007, -284}, {0x8dd01fad907ffc3cull, -980, -276},
+    {0xd3515c2831559a83ull, -954, -268}, {0x9d71ac8fada6c9b5ull, -927, -260},
+    {0xea9c227723ee8bcbull, -901, -252}, {0xaecc49914078536dull, -874, -244},
+    {0x823c12795db6ce57ull, -847, -236}, {0xc21094364dfb5637ull, -821, -228},
+    {0x9096ea6f3848984full, -794, -220}, {0xd77485cb25823ac7ull, -768, -212},
+    {0xa086cfcd97bf97f4ull, -741, -204}, {0xef340a98172aace5ull, -715, -196},
+    {0xb23867fb2a35b28eull, -688, -188}, {0x84c8d4dfd2c63f3bull, -661, -180},
+    {0xc5dd44271ad3cdbaull, -635, -172}, {0x936b9fcebb25c996ull, -608, -164},
+    {0xdbac6c247d62a584ull, -582, -156}, {0xa3ab66580d5fdaf6ull, -555, -148},
+    {0xf3e2f893dec3f126ull, -529, -140}, {0xb5b5ada8aaff80b8ull, -502, -132},
+    {0x87625f056c7c4a8bull, -475, -124}, {0xc9bcff6034c13053ull, -449, -116},
+    {0x964e858c91ba2655ull, -422, -108}, {0xdff9772470297ebdull, -396, -100},
+    {0xa6dfbd9fb8e5b88full, -369, -92}, {0xf8a95fcf88747d94ull, -343, -84},
+    {0xb94470938fa89bcfull, -316, -76}, {0x8a08f0f8bf0f156bull, -289, -68},
+    {0xcdb02555653131b6ull, -263, -60}, {0x993fe2c6d07b7facull, -236, -52},
+    {0xe45c10c42a2b3b06ull, -210, -44}, {0xaa242499697392d3ull, -183, -36},
+    {0xfd87b5f28300ca0eull, -157, -28}, {0xbce5086492111aebull, -130, -20},
+    {0x8cbccc096f5088ccull, -103, -12}, {0xd1b71758e219652cull, -77, -4},
+    {0x9c40000000000000ull, -50, 4}, {0xe8d4a51000000000ull, -24, 12},
+    {0xad78ebc5ac620000ull, 3, 20}, {0x813f3978f8940984ull, 30, 28},
+    {0xc097ce7bc90715b3ull, 56, 36}, {0x8f7e32ce7bea5c70ull, 83, 44},
+    {0xd5d238a4abe98068ull, 109, 52}, {0x9f4f2726179a2245ull, 136, 60},
+    {0xed63a231d4c4fb27ull, 162, 68}, {0xb0de65388cc8ada8ull, 189, 76},
+    {0x83c7088e1aab65dbull, 216, 84}, {0xc45d1df942711d9aull, 242, 92},
+    {0x924d692ca61be758ull, 269, 100}, {0xda01ee641a708deaull, 295, 108},
+    {0xa26da3999aef774aull, 322, 116}, {0xf209787bb47d6b85ull, 348, 124},
+    {0xb454e4a179dd1877ull, 375, 132}, {0x865b86925b9bc5c2ull, 402, 140},
+    {0xc83553c5c8965d3dull, 428, 148}, {0x952ab45cfa97a0b3ull, 455, 156},
+    {0xde469fbd99a05fe3ull, 481, 164}, {0xa59bc234db398c25ull, 508, 172},
+    {0xf6c69a72a3989f5cull, 534, 180}, {0xb7dcbf5354e9beceull, 561, 188},
+    {0x88fcf317f22241e2ull, 588, 196}, {0xcc20ce9bd35c78a5ull, 614, 204},
+    {0x98165af37b2153dfull, 641, 212}, {0xe2a0b5dc971f303aull, 667, 220},
+    {0xa8d9d1535ce3b396ull, 694, 228}, {0xfb9b7cd9a4a7443cull, 720, 236},
+    {0xbb764c4ca7a44410ull, 747, 244}, {0x8bab8eefb6409c1aull, 774, 252},
+    {0xd01fef10a657842cull, 800, 260}, {0x9b10a4e5e9913129ull, 827, 268},
+    {0xe7109bfba19c0c9dull, 853, 276}, {0xac2820d9623bf429ull, 880, 284},
+    {0x80444b5e7aa7cf85ull, 907, 292}, {0xbf21e44003acdd2dull, 933, 300},
+    {0x8e679c2f5e44ff8full, 960, 308}, {0xd433179d9c8cb841ull, 986, 316},
+    {0x9e19db92b4e31ba9ull, 1013, 324}, {0xeb96bf6ebadf77d9ull, 1039, 332},
+    {0xaf87023b9bf0ee6bull, 1066, 340}
+};
+
+DiyFp multiply(DiyFp x, DiyFp y)
+{
+    const uint64_t mask = 0xffffffff;
+    const uint64_t a = x.f_ >> 32, b = x.f_ & mask;
+    const uint64_t c = y.f_ >> 32, d = y.f_ & mask;
+    const uint64_t ac = a * c, bc = b * c, ad = a * d, bd = b * d;
+    uint64_t middle = (bd >> 32) + (ad & mask) + (bc & mask);
+    middle += uint64_t(1) << 31; // Round the discarded half.
+    return {ac + (ad >> 32) + (bc >> 32) + (middle >> 32), x.e_ + y.e_ + 64};
+}
+
+DiyFp normalize(DiyFp x)
+{
+    while (not(x.f_ & (uint64_t(1) << 63))) {
+        x.f_ <<= 1;
+        --x.e_;
+    }
+    return x;
+}
+
+// Steps the last digit down towards the value, while that keeps it closer,
+// and within the neighbours. Returns false if the digits might not be the
+// closest, or might not round trip.
+bool roundWeed(char* digits, int length, uint64_t distanceTooHighW,
+               uint64_t unsafeInterval, uint64_t rest, uint64_t tenKappa,
+               uint64_t unit)
+{
+    const uint64_t smallDistance = distanceTooHighW - unit;
+    const uint64_t bigDistance = distanceTooHighW + unit;
+    while (rest < smallDistance and unsafeInterval - rest >= tenKappa and
+           (rest + tenKappa < smallDistance or
+            smallDistance - rest >= rest + tenKappa - smallDistance)) {
+        --digits[length - 1];
+        rest += tenKappa;
+    }
+    if (rest < bigDistance and unsafeInterval - rest >= tenKappa and
+        (rest + tenKappa < bigDistance or
+         bigDistance - rest > rest + tenKappa - bigDistance)) {
+        return false;
+    }
+    return 2 * unit <= rest and rest <= unsafeInterval - 4 * unit;
+}
+
+bool generateDigits(DiyFp low, DiyFp w, DiyFp high, char* digits,
+                    int& length, int& kappa)
+{
+    uint64_t unit = 1;
+    const DiyFp tooLow = {low.f_ - unit, low.e_};
+    const DiyFp tooHigh = {high.f_ + unit, high.e_};
+    uint64_t unsafeInterval = tooHigh.f_ - tooLow.f_;
+    const int shift = -w.e_;
+    const uint64_t one = uint64_t(1) << shift;
+    uint32_t integrals = uint32_t(tooHigh.f_ >> shift);
+    uint64_t fractionals = tooHigh.f_ & (one - 1);
+    uint32_t divisor = 1;
+    kappa = 1;
+    while (divisor <= integrals / 10) {
+        divisor *= 10;
+        ++kappa;
+    }
+    length = 0;
+    while (kappa > 0) {
+        digits[length++] = char('0' + integrals / divisor);
+        integrals %= divisor;
+        --kappa;
+        const uint64_t rest = (uint64_t(integrals) << shift) + fractionals;
+        if (rest < unsafeInterval) {
+            return roundWeed(digits, length, tooHigh.f_ - w.f_,
+                             unsafeInterval, rest, uint64_t(divisor) << shift,
+                             unit);
+        }
+        divisor /= 10;
+    }
+    while (true) {
+        fractionals *= 10;
+        unit *= 10;
+        unsafeInterval *= 10;
+        digits[length++] = char('0' + (fractionals >> shift));
+        fractionals &= one - 1;
+        --kappa;
+        if (fractionals < unsafeInterval) {
+            return roundWeed(digits, length, (tooHigh.f_ - w.f_) * unit,
+                             unsafeInterval, fractionals, one, unit);
+        }
+    }
+}
+
+// For a positive, finite value, finds the shortest digits that read back as
+// value, such that value is digits * 10^exponent.
+bool grisu3(double value, char* digits, int& length, int& exponent)
+{
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof bits);
+    const uint64_t hidden = uint64_t(1) << 52;
+    const int biased = int(bits >> 52) & 0x7ff;
+    const uint64_t fraction = bits & (hidden - 1);
+    DiyFp v = biased ? DiyFp{fraction | hidden, biased - 1075}
+                     : DiyFp{fraction, -1074};
+
+    // The neighbours are half way to the next representable values. Below a
+    // power of two, the next value down is half as far away.
+    const DiyFp plus = normalize({(v.f_ << 1) + 1, v.e_ - 1});
+    DiyFp minus = (fraction == 0 and biased > 1)
+                      ? DiyFp{(v.f_ << 2) - 1, v.e_ - 2}
+                      : DiyFp{(v.f_ << 1) - 1, v.e_ - 1};
+    minus.f_ <<= minus.e_ - plus.e_;
+    minus.e_ = plus.e_;
+    const DiyFp w = normalize(v);
+
+    // Picks the power of ten that scales w's binary exponent into [-60, -32],
+    // so that the integral part of the scaled value fits in 32 bits.
+    const int minExponent = -60 - (w.e_ + 64);
+    const double k = std::ceil((minExponent + 63) * 0.30102999566398114);
+    const auto& power = cachedPowers[(348 + int(k) - 1) / 8 + 1];
+    const DiyFp tenMk = {power.significand_, power.binaryExponent_};
+
+    int kappa;
+    const bool found =
+        generateDigits(multiply(minus, tenMk), multiply(w, tenMk),
+                       multiply(plus, tenMk), digits, length, kappa);
+    exponent = kappa - power.decimalExponent_;
+    return found;
+}
+
+} // namespace
+
+void formatFloat(std::string& out, double value)
+{
+    // Whole numbers are common, and their digits are all there is to print.
+    if (std::fabs(value) < 1e15 and double((long long)value) == value and
+        not(value == 0 and std::signbit(value))) {
+        formatInteger(out, (long long)value);
+        return;
+    }
+    char digits[32];
+    int length;
+    int exponent;
+    if (not std::isfinite(value) or value == 0 or
+        not grisu3(std::fabs(value), digits, length, exponent)) {
+        // Fifteen significant digits are enough for any decimal number with
+        // as many digits to survive the trip through a double, and %g drops
+        // trailing zeros, so this finds the shortest text for most values.
+        // The rest need sixteen or seventeen digits.
+        int printed = 0;
+        for (int precision = 15; precision <= 17; ++precision) {
+            printed = snprintf(digits, sizeof digits, "%.*g", precision, value);
+            if (strtod(digits, nullptr) == value) {
+                break;
+            }
+        }
+        out.append(digits, printed);
+        return;
+    }
+
+    // Lays the digits out as %.15g would, or with more precision when there
+    // are more digits.
+    if (value < 0) {
+        out += '-';
+    }
+    const int point = length + exponent; // Digits before the decimal point.
+    const int precision = std::max(length, 15);
+    if (point - 1 < -4 or point - 1 >= precision) {
+        out += digits[0];
+        if (length > 1) {
+            out += '.';
+            out.append(digits + 1, length - 1);
+        }
+        const int scale = point - 1;
+        out += scale < 0 ? "e-" : "e+";
+        if (std::abs(scale) < 10) {
+            out += '0';
+        }
+        formatInteger(out, std::abs(scale));
+    } else if (point <= 0) {
+        out += "0.";
+        out.append(-point, '0');
+        out.append(digits, length);
+    } else if (point >= length) {
+        out.append(digits, length);
+        out.append(point - length, '0');
+    } else {
+        out.append(digits, point);
+        out += '.';
+        out.append(digits + point, length - point);
+    }
+}
+
+} // namespace ebl
@@ -0,0 +1,28 @@
+#pragma once
+
+#include <string>
+
+namespace ebl {
+
+// Conversions between numbers and text. These work directly over a range of
+// bytes, so they can run over a String's storage, or the lexer's buffer,
+// without copying it, and they never go through a stream or the locale.
+
+// Parses an optional minus sign followed by decimal digits, from the start of
+// the bytes from begin up to end, in the manner of std::from_chars. Returns
+// the position just after the number, or begin, if the text doesn't start
+// with a number, or if the number doesn't fit in a long long.
+const char* parseInteger(const char* begin, const char* end, long long& value);
+
+// As parseInteger(), for a decimal number with an optional fraction and
+// exponent, or for inf, infinity or nan. The result is correctly rounded.
+const char* parseFloat(const char* begin, const char* end, double& value);
+
+// Appends the decimal digits of value to out.
+void formatInteger(std::string& out, long long value);
+
+// Appends the shortest text that parses back to exactly value, laid out like
+// printf's %g, i.e. with an exponent for very large or small values.
+void formatFloat(std::string& out, double value);
+
+} // namespace ebl
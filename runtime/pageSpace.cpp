@@ -0,0 +1,119 @@
+#include "pageSpace.hpp"
+#include <stdlib.h>
+
+namespace ebl {
+
+static size_t cellSize(size_t sizeClass)
+{
+    return (sizeClass + 1) * PageSpace::granule;
+}
+
+static size_t cellsPerPage(size_t sizeClass)
+{
+    return PageSpace::pageSize / cellSize(sizeClass);
+}
+
+PageSpace::PageSpace(size_t capacity)
+{
+    const size_t pageCount = capacity / pageSize;
+    if (pageCount == 0) {
+        throw std::runtime_error("page space must hold at least one page");
+    }
+    // Mapped, so that pages cost nothing until they're first assigned.
+    begin_ = (uint8_t*)mapPages(pageCount * pageSize, false);
+    if (not begin_) {
+        throw std::runtime_error("failed to allocate a page space");
+    }
+    end_ = begin_ + pageCount * pageSize;
+    live_.resize(pageCount * wordsPerPage);
+    marks_.resize(pageCount * wordsPerPage);
+    pages_.resize(pageCount, PageInfo{unassigned, 0});
+}
+
+PageSpace::~PageSpace()
+{
+    unmapPages(begin_, end_ - begin_);
+}
+
+// Links the page's free cells into the size class's free list, in address
+// order.
+void PageSpace::threadFreeCells(size_t page, size_t sizeClass)
+{
+    uint8_t* const pageBegin = begin_ + page * pageSize;
+    const size_t size = cellSize(sizeClass);
+    uint8_t* head = classes_[sizeClass].freeList_;
+    for (size_t i = cellsPerPage(sizeClass); i > 0; --i) {
+        uint8_t* const cell = pageBegin + (i - 1) * size;
+        const size_t bit = bitIndex(cell);
+        if (not(live_[bit / 64] & (uint64_t(1) << (bit % 64)))) {
+            *reinterpret_cast<uint8_t**>(cell) = head;
+            head = cell;
+        }
+    }
+    classes_[sizeClass].freeList_ = head;
+}
+
+bool PageSpace::refill(size_t sizeClass)
+{
+    auto& partial = classes_[sizeClass].partialPages_;
+    size_t page;
+    if (not partial.empty()) {
+        page = partial.back();
+        partial.pop_back();
+    } else if (not freePages_.empty()) {
+        page = freePages_.back();
+        freePages_.pop_back();
+    } else if (pagesInUse_ < pages_.size()) {
+        page = pagesInUse_++;
+    } else {
+        return false;
+    }
+    pages_[page].sizeClass_ = sizeClass;
+    threadFreeCells(page, sizeClass);
+    return true;
+}
+
+size_t PageSpace::sweep(std::array<size_t, typeCount>& liveObjects)
+{
+    // The free lists may run through cells that are about to be freed or
+    // reused, so they're rebuilt from the bitmaps as pages are needed again.
+    for (auto& cls : classes_) {
+        cls.freeList_ = nullptr;
+        cls.partialPages_.clear();
+    }
+    freePages_.clear();
+    size_t reclaimed = 0;
+    for (size_t page = 0; page < pagesInUse_; ++page) {
+        auto& info = pages_[page];
+        if (info.sizeClass_ == unassigned) {
+            freePages_.push_back(page);
+            continue;
+        }
+        size_t liveCells = 0;
+        const size_t firstWord = page * wordsPerPage;
+        for (size_t w = firstWord; w < firstWord + wordsPerPage; ++w) {
+            uint64_t survivors = live_[w] & marks_[w];
+            liveCells += __builtin_popcountll(survivors);
+            live_[w] = survivors;
+            marks_[w] = 0;
+            while (survivors) {
+                const size_t bit = w * 64 + ctz(survivors);
+                survivors &= survivors - 1;
+                auto val = reinterpret_cast<Value*>(begin_ + bit * granule);
+                ++liveObjects[val->typeId()];
+            }
+        }
+        reclaimed += (info.liveCells_ - liveCells) * cellSize(info.sizeClass_);
+        info.liveCells_ = liveCells;
+        if (liveCells == 0) {
+            info.sizeClass_ = unassigned;
+            freePages_.push_back(page);
+        } else if (liveCells < cellsPerPage(info.sizeClass_)) {
+            classes_[info.sizeClass_].partialPages_.push_back(page);
+        }
+    }
+    used_ -= reclaimed;
+    return reclaimed;
+}
+
+} // namespace ebl
@@ -0,0 +1,164 @@
+#pragma once
+
+#include "macros.hpp"
+#include "types.hpp"
+#include <array>
+#include <type_traits>
+#include <vector>
+
+namespace ebl {
+
+// PageSpace is a non-moving heap for Pairs and other small fixed size values,
+// used by the segregated heap layout (see Context::Configuration). The space
+// is divided into pages, and each page holds cells of a single size class, so
+// the collector can find every value in a page without consulting the type
+// table. Each page has a mark bitmap and a live bitmap, with one bit per
+// eight bytes. The collector marks values here in the bitmap rather than in
+// the value header, sweeping a page clears the live bits of unmarked cells,
+// and allocation reuses free cells through a per size class free list, which
+// is rebuilt lazily, one page at a time.
+class PageSpace {
+public:
+    static constexpr const size_t pageSize = 4096;
+    static constexpr const size_t granule = 8;
+    static constexpr const size_t sizeClasses = 3; // 8, 16, and 24 bytes
+
+    // Values with finalizers need to stay in the main heap, where the
+    // collector tracks them.
+    template <typename T>
+    struct Eligible
+        : std::integral_constant<bool,
+                                 std::is_trivially_destructible<T>::value and
+                                     sizeof(T) % granule == 0 and
+                                     sizeof(T) <= granule * sizeClasses> {
+    };
+
+    PageSpace(size_t capacity);
+    PageSpace(const PageSpace&) = delete;
+    ~PageSpace();
+
+    // Returns null when the space is exhausted.
+    template <typename T> T* alloc()
+    {
+        static_assert(Eligible<T>::value, "type not eligible for PageSpace");
+        return reinterpret_cast<T*>(allocate(sizeof(T) / granule - 1));
+    }
+
+    bool contains(const void* address) const
+    {
+        return address >= begin_ and address < end_;
+    }
+
+    // Sets the mark bit for a value, returning its previous state.
+    bool testAndMark(const void* address)
+    {
+        const size_t bit = bitIndex(address);
+        uint64_t& word = marks_[bit / 64];
+        const uint64_t mask = uint64_t(1) << (bit % 64);
+        const bool wasMarked = word & mask;
+        word |= mask;
+        return wasMarked;
+    }
+
+    // As testAndMark(), but safe to call from several threads at once.
+    bool testAndMarkShared(const void* address)
+    {
+        const size_t bit = bitIndex(address);
+        const uint64_t mask = uint64_t(1) << (bit % 64);
+        return __atomic_fetch_or(&marks_[bit / 64], mask, __ATOMIC_RELAXED) &
+               mask;
+    }
+
+    bool marked(const void* address) const
+    {
+        const size_t bit = bitIndex(address);
+        return marks_[bit / 64] & (uint64_t(1) << (bit % 64));
+    }
+
+    // Frees the unmarked cells and clears the mark bits. Returns the number
+    // of bytes reclaimed, and adds surviving values to the per-type counts.
+    size_t sweep(std::array<size_t, typeCount>& liveObjects);
+
+    template <typename F> void forEachLive(F&& callback)
+    {
+        for (size_t page = 0; page < pages_.size(); ++page) {
+            if (pages_[page].sizeClass_ == unassigned) {
+                continue;
+            }
+            const size_t firstWord = page * wordsPerPage;
+            for (size_t w = 0; w < wordsPerPage; ++w) {
+                uint64_t bits = live_[firstWord + w];
+                while (bits) {
+                    const size_t bit = (firstWord + w) * 64 + ctz(bits);
+                    bits &= bits - 1;
+                    callback(reinterpret_cast<Value*>(begin_ + bit * granule));
+                }
+            }
+        }
+    }
+
+    // Bytes held by live (or not yet swept) values.
+    size_t size() const
+    {
+        return used_;
+    }
+
+    size_t capacity() const
+    {
+        return end_ - begin_;
+    }
+
+private:
+    static constexpr const size_t wordsPerPage = pageSize / granule / 64;
+    static constexpr const uint8_t unassigned = 0xff;
+
+    struct PageInfo {
+        uint8_t sizeClass_;
+        uint16_t liveCells_;
+    };
+
+    struct SizeClass {
+        uint8_t* freeList_ = nullptr;
+        std::vector<size_t> partialPages_;
+    };
+
+    static size_t ctz(uint64_t bits)
+    {
+        return __builtin_ctzll(bits);
+    }
+
+    size_t bitIndex(const void* address) const
+    {
+        return ((const uint8_t*)address - begin_) / granule;
+    }
+
+    inline uint8_t* allocate(size_t sizeClass)
+    {
+        auto& cls = classes_[sizeClass];
+        if (UNLIKELY(not cls.freeList_) and not refill(sizeClass)) {
+            return nullptr;
+        }
+        uint8_t* const cell = cls.freeList_;
+        cls.freeList_ = *reinterpret_cast<uint8_t**>(cell);
+        const size_t bit = bitIndex(cell);
+        live_[bit / 64] |= uint64_t(1) << (bit % 64);
+        ++pages_[bit / (pageSize / granule)].liveCells_;
+        used_ += (sizeClass + 1) * granule;
+        return cell;
+    }
+
+    bool refill(size_t sizeClass);
+    void threadFreeCells(size_t page, size_t sizeClass);
+
+    uint8_t* begin_;
+    uint8_t* end_;
+    size_t pagesInUse_ = 0;
+    size_t used_ = 0;
+    std::vector<uint64_t> live_;
+    std::vector<uint64_t> marks_;
+    std::vector<PageInfo> pages_;
+    std::vector<size_t> freePages_;
+    std::array<SizeClass, sizeClasses> classes_;
+};
+
+} // namespace ebl
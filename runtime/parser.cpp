@@ -1,5 +1,6 @@
 #include "parser.hpp"
 #include "lexer.hpp"
+#include "utf8.hpp"
 #include "utility.hpp"
 
 // This parser could be better... I'm considering rewriting the
@@ -41,27 +42,27 @@ ast::Ptr<ast::Value> parseValue(const std::string& name)
     }
 }
 
-ast::Ptr<ast::Literal> parseLiteral(Lexer::Token tok, const std::string& strval)
+ast::Ptr<ast::Literal> parseLiteral(Lexer::Token tok, Lexer& lexer)
 {
     switch (tok) {
     case Lexer::Token::INTEGER: {
         auto ret = make_unique<ast::Integer>();
-        ret->value_ = std::stoi(strval);
+        ret->value_ = lexer.integerValue();
         return std::move(ret);
     }
     case Lexer::Token::SYMBOL: {
         auto ret = make_unique<ast::Symbol>();
-        ret->value_ = strval;
+        ret->value_ = lexer.rdbuf();
         return std::move(ret);
     }
     case Lexer::Token::STRING: {
         auto ret = make_unique<ast::String>();
-        ret->value_ = strval;
+        ret->value_ = lexer.rdbuf();
         return std::move(ret);
     }
     case Lexer::Token::FLOAT: {
         auto ret = make_unique<ast::Float>();
-        ret->value_ = std::stod(strval);
+        ret->value_ = lexer.floatValue();
         return std::move(ret);
     }
     default:
@@ -82,7 +83,7 @@ ast::Ptr<ast::Literal> parseListLiteral(Lexer& lexer)
         case Lexer::Token::SYMBOL:
         case Lexer::Token::INTEGER:
         case Lexer::Token::FLOAT:
-            list->contents_.push_back(parseLiteral(tok, lexer.rdbuf()));
+            list->contents_.push_back(parseLiteral(tok, lexer));
             break;
 
         case Lexer::Token::DOT: {
@@ -97,7 +98,7 @@ ast::Ptr<ast::Literal> parseListLiteral(Lexer& lexer)
             case Lexer::Token::SYMBOL:
             case Lexer::Token::STRING:
             case Lexer::Token::FLOAT:
-                pair->second_ = parseLiteral(tok, lexer.rdbuf());
+                pair->second_ = parseLiteral(tok, lexer);
                 break;
 
             default:
@@ -128,7 +129,7 @@ ast::Ptr<ast::Statement> parseQuoted(Lexer& lexer)
     case Lexer::Token::SYMBOL:
     case Lexer::Token::INTEGER:
     case Lexer::Token::FLOAT:
-        return parseLiteral(tok, lexer.rdbuf());
+        return parseLiteral(tok, lexer);
 
     default:
         throw std::runtime_error("TODO: support non-list quoted values");
@@ -153,13 +154,13 @@ ast::Ptr<ast::Statement> parseStatement(Lexer& lexer)
 
     case Lexer::Token::INTEGER: {
         auto ret = make_unique<ast::Integer>();
-        ret->value_ = std::stoi(lexer.rdbuf());
+        ret->value_ = lexer.integerValue();
         return std::move(ret);
     }
 
     case Lexer::Token::FLOAT: {
         auto ret = make_unique<ast::Float>();
-        ret->value_ = std::stod(lexer.rdbuf());
+        ret->value_ = lexer.floatValue();
         return std::move(ret);
     }
 
@@ -174,7 +175,7 @@ ast::Ptr<ast::Statement> parseStatement(Lexer& lexer)
 
     case Lexer::Token::CHAR: {
         auto ret = make_unique<ast::Character>();
-        if (utf8Len(lexer.rdbuf().c_str(), lexer.rdbuf().length()) not_eq 1) {
+        if (utf8Length(lexer.rdbuf().data(), lexer.rdbuf().size()) not_eq 1) {
             throw std::runtime_error("char literal " + lexer.rdbuf() +
                                      " contains multiple glyphs!");
         }
@@ -534,14 +535,14 @@ ast::Ptr<ast::Expr> parseExpr(Lexer& lexer)
 
         case Lexer::Token::INTEGER: {
             auto param = make_unique<ast::Integer>();
-            param->value_ = std::stoi(lexer.rdbuf());
+            param->value_ = lexer.integerValue();
             apply->args_.push_back(std::move(param));
             break;
         }
 
         case Lexer::Token::FLOAT: {
             auto param = make_unique<ast::Float>();
-            param->value_ = std::stod(lexer.rdbuf());
+            param->value_ = lexer.floatValue();
             apply->args_.push_back(std::move(param));
             break;
         }
@@ -560,7 +561,7 @@ ast::Ptr<ast::Expr> parseExpr(Lexer& lexer)
 
         case Lexer::Token::CHAR: {
             auto param = make_unique<ast::Character>();
-            if (utf8Len(lexer.rdbuf().c_str(), lexer.rdbuf().length()) not_eq
+            if (utf8Length(lexer.rdbuf().data(), lexer.rdbuf().size()) not_eq
                 1) {
                 throw std::runtime_error("char literal " + lexer.rdbuf() +
                                          " contains multiple glyphs!");
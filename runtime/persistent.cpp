@@ -4,17 +4,16 @@
 
 namespace ebl {
 
+// The context holds the most recently created persistent, and the
+// collector walks the list through next().
 PersistentBase::PersistentBase(Environment& env, ValuePtr val)
-    : val_(val), next_(nullptr)
+    : val_(val), head_(&env.getContext()->getPersistentsList()),
+      prev_(nullptr), next_(*head_)
 {
-    auto& plist = env.getContext()->getPersistentsList();
-    if (plist) {
-        plist->next_ = this;
-        prev_ = plist;
-    } else {
-        prev_ = nullptr;
+    if (next_) {
+        next_->prev_ = this;
     }
-    plist = this;
+    *head_ = this;
 }
 
 PersistentBase::~PersistentBase()
@@ -24,6 +23,8 @@ PersistentBase::~PersistentBase()
     }
     if (prev_) {
         prev_->next_ = next_;
+    } else {
+        *head_ = next_;
     }
 }
 
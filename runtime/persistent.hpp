@@ -8,7 +8,8 @@
 // operation. You could run into caching issues if you use Persistents
 // indiscriminately though, so it's better to leave ebl values in
 // the input Arguments if possible, and to keep your wrapped
-// CFunctions small.
+// CFunctions small. For values that only need to live as long as a
+// native call, prefer a Handle (see handle.hpp), which is much cheaper.
 
 namespace ebl {
 
@@ -50,6 +51,7 @@ public:
 
 protected:
     ValuePtr val_;
+    PersistentBase** head_;
     PersistentBase* prev_;
     PersistentBase* next_;
 };
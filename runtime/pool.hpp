@@ -1,67 +1,229 @@
+#pragma once
+
 #include "macros.hpp"
+#include "spinlock.hpp"
 #include <array>
 #include <cassert>
 #include <mutex>
+#include <new>
 #include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
 
 namespace ebl {
 
 // NOTE: Pools are only designed for scalar allocations. The whole
 // intent of this class is specifically for use with allocate_shared,
 // for allocating environment frames.
+//
+// Each thread allocates from, and frees to, its own magazine, a small stack
+// of free nodes, without synchronization. Magazines exchange nodes with a
+// global depot in batches, so the depot's lock is only taken once per
+// several allocations, and threads running separate Contexts rarely contend
+// with each other. The depot carves nodes out of 4KB aligned blocks, and
+// keeps a count of the free nodes in each block, so that blocks can be
+// returned to the system once all of their nodes are free.
 
 template <typename T> struct PoolAllocator {
     typedef T value_type;
 
     class Pool {
     private:
-        struct Node {
+        union Node {
             alignas(T) std::array<uint8_t, sizeof(T)> mem_;
             Node* next_;
         };
 
+        static constexpr const size_t blockSize = 4096;
+
+        struct alignas(T) Block {
+            Block* prev_;
+            Block* next_;
+            Node* freelist_;
+            size_t freeCount_;
+        };
+
+        static constexpr const size_t nodesPerBlock =
+            (blockSize - sizeof(Block)) / sizeof(Node);
+
+        static_assert(nodesPerBlock > 0, "type too large for a pool block");
+
+        // Fully free blocks beyond this many are released.
+        static constexpr const size_t retainedBlocks = 2;
+
+        static Block* blockOf(Node* node)
+        {
+            return (Block*)((uintptr_t)node & ~(uintptr_t)(blockSize - 1));
+        }
+
+        static Node* nodes(Block* block)
+        {
+            return (Node*)(block + 1);
+        }
+
+        static void* allocBlock()
+        {
+#if defined(_WIN32) or defined(_WIN64)
+            void* mem = _aligned_malloc(blockSize, blockSize);
+#else
+            void* mem = nullptr;
+            if (posix_memalign(&mem, blockSize, blockSize) not_eq 0) {
+                mem = nullptr;
+            }
+#endif
+            if (not mem) {
+                throw std::bad_alloc();
+            }
+            return mem;
+        }
+
+        static void freeBlock(void* mem)
+        {
+#if defined(_WIN32) or defined(_WIN64)
+            _aligned_free(mem);
+#else
+            free(mem);
+#endif
+        }
+
+        // The depot keeps the blocks that have free nodes on a list, with
+        // partially used blocks at the front, so that refills drain them
+        // first, and fully free blocks at the back.
+        void link(Block* block, bool front)
+        {
+            block->prev_ = front ? nullptr : tail_;
+            block->next_ = front ? head_ : nullptr;
+            (block->prev_ ? block->prev_->next_ : head_) = block;
+            (block->next_ ? block->next_->prev_ : tail_) = block;
+        }
+
+        void unlink(Block* block)
+        {
+            (block->prev_ ? block->prev_->next_ : head_) = block->next_;
+            (block->next_ ? block->next_->prev_ : tail_) = block->prev_;
+        }
+
         void grow()
         {
-            constexpr size_t allocCount = 4096 / sizeof(Node);
-            constexpr size_t allocSize = allocCount * sizeof(Node);
-            auto nodes = (Node*)malloc(allocSize);
-            for (size_t i = 0; i < allocCount; ++i) {
-                Node* current = &nodes[i];
-                current->next_ = freelist_;
-                freelist_ = current;
+            auto block = new (allocBlock()) Block{nullptr, nullptr, nullptr,
+                                                  nodesPerBlock};
+            for (size_t i = nodesPerBlock; i > 0; --i) {
+                Node* const node = &nodes(block)[i - 1];
+                node->next_ = block->freelist_;
+                block->freelist_ = node;
             }
+            link(block, false);
+            ++emptyBlocks_;
         }
 
     public:
-        Pool() : freelist_(nullptr)
+        static constexpr const size_t magazineSize = 32;
+
+        class Magazine {
+        public:
+            ~Magazine()
+            {
+                if (count_) {
+                    pool.flush(nodes_.data(), count_);
+                }
+            }
+
+            void* alloc()
+            {
+                if (UNLIKELY(count_ == 0)) {
+                    count_ = pool.refill(nodes_.data(), magazineSize / 2);
+                }
+                return nodes_[--count_];
+            }
+
+            void dealloc(void* mem)
+            {
+                if (UNLIKELY(count_ == magazineSize)) {
+                    count_ -= magazineSize / 2;
+                    pool.flush(nodes_.data() + count_, magazineSize / 2);
+                }
+                nodes_[count_++] = (Node*)mem;
+            }
+
+        private:
+            std::array<Node*, magazineSize> nodes_;
+            size_t count_ = 0;
+        };
+
+        Pool() : head_(nullptr), tail_(nullptr), emptyBlocks_(0)
+        {
+        }
+
+        // Moves up to count nodes into out, returns the number moved.
+        size_t refill(Node** out, size_t count)
         {
+            std::lock_guard<Spinlock> guard(lock_);
+            size_t moved = 0;
+            while (moved < count) {
+                if (not head_) {
+                    grow();
+                }
+                Block* const block = head_;
+                if (block->freeCount_ == nodesPerBlock) {
+                    --emptyBlocks_;
+                }
+                while (moved < count and block->freelist_) {
+                    out[moved++] = block->freelist_;
+                    block->freelist_ = block->freelist_->next_;
+                    --block->freeCount_;
+                }
+                if (block->freeCount_ == 0) {
+                    unlink(block);
+                }
+            }
+            return moved;
         }
 
-        void* alloc()
+        void flush(Node** in, size_t count)
         {
-            std::lock_guard<std::mutex> guard(lock_);
-            if (UNLIKELY(freelist_ == nullptr)) {
-                grow();
+            std::lock_guard<Spinlock> guard(lock_);
+            for (size_t i = 0; i < count; ++i) {
+                Node* const node = in[i];
+                Block* const block = blockOf(node);
+                node->next_ = block->freelist_;
+                block->freelist_ = node;
+                if (block->freeCount_++ == 0) {
+                    link(block, true);
+                }
+                if (block->freeCount_ == nodesPerBlock) {
+                    unlink(block);
+                    if (emptyBlocks_ < retainedBlocks) {
+                        link(block, false);
+                        ++emptyBlocks_;
+                    } else {
+                        freeBlock(block);
+                    }
+                }
             }
-            void* const ret = freelist_->mem_.data();
-            freelist_ = freelist_->next_;
-            return ret;
         }
 
-        void dealloc(void* mem)
+        ~Pool()
         {
-            std::lock_guard<std::mutex> guard(lock_);
-            auto node = (Node*)mem;
-            node->next_ = freelist_;
-            freelist_ = node;
+            // Blocks with nodes still in use (or sitting in a magazine) are
+            // leaked, rather than freed out from under their users.
+            while (head_) {
+                Block* const block = head_;
+                unlink(block);
+                if (block->freeCount_ == nodesPerBlock) {
+                    freeBlock(block);
+                }
+            }
         }
 
     private:
-        Node* freelist_;
-        std::mutex lock_;
+        Block* head_;
+        Block* tail_;
+        size_t emptyBlocks_;
+        Spinlock lock_;
     };
 
     static Pool pool;
+    static thread_local typename Pool::Magazine magazine;
 
     PoolAllocator() noexcept {};
 
@@ -70,17 +232,22 @@ template <typename T> struct PoolAllocator {
 
     T* allocate(size_t n, const void* hint = 0)
     {
-        return static_cast<T*>(pool.alloc());
+        assert(n == 1);
+        return static_cast<T*>(magazine.alloc());
     }
 
     void deallocate(T* ptr, size_t n)
     {
-        pool.dealloc(ptr);
+        magazine.dealloc(ptr);
     }
 };
 
 template <typename T> typename PoolAllocator<T>::Pool PoolAllocator<T>::pool;
 
+template <typename T>
+thread_local typename PoolAllocator<T>::Pool::Magazine
+    PoolAllocator<T>::magazine;
+
 template <typename T, typename U>
 inline bool operator==(const PoolAllocator<T>&, const PoolAllocator<U>&)
 {
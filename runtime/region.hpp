@@ -0,0 +1,150 @@
+#pragma once
+
+#include "markBitmap.hpp"
+#include "memory.hpp"
+#include "types.hpp"
+#include <memory>
+#include <vector>
+
+namespace ebl {
+
+// A Region is a bump allocated arena for values that are expected to die
+// together, see Context::openRegion(). Collections never move the values in
+// an open region, and treat all of them as roots. When the region closes, or
+// its arena fills up, the collector moves the values that are still
+// reachable into the heap (see MarkCompact::evacuate()), and the rest of the
+// arena is discarded in one step, without collecting the heap.
+//
+// Values that escape a region are found by tracing from the roots, through
+// values in the region only. References can only leave the region by way of
+// the roots, or by a store into a frame or a value that existed before the
+// region was opened, so the write barrier remembers those containers, see
+// Context::writeBarrier().
+class Region {
+public:
+    Region(size_t capacity) : capacity_(capacity)
+    {
+    }
+
+    Region(const Region&) = delete;
+
+    bool isOpen() const
+    {
+        return open_;
+    }
+
+    // Increases by one each time a region is opened.
+    size_t serial() const
+    {
+        return serial_;
+    }
+
+    bool contains(const void* address) const
+    {
+        return arena_ and address >= arena_->begin() and
+               address < arena_->end();
+    }
+
+    void open()
+    {
+        if (not arena_) {
+            arena_.reset(new Heap(capacity_, Heap::Mapped{false}));
+            marks_.reset(new MarkBitmap(*arena_));
+        }
+        open_ = true;
+        ++serial_;
+    }
+
+    // Returns null when the arena is full. A collection can't make room in
+    // a region, so there's nothing to retry.
+    template <typename T> uint8_t* tryAlloc()
+    {
+        return arena_->tryAlloc<T>();
+    }
+
+    uint8_t* tryAllocBytes(size_t bytes)
+    {
+        return arena_->tryAllocBytes(bytes);
+    }
+
+    // Calls visit on every value in the region, in address order.
+    template <typename F> void forEach(F&& visit) const
+    {
+        uint8_t* current = arena_->begin();
+        while (current < arena_->end()) {
+            auto val = (Value*)current;
+            current += valueSize(val);
+            visit(val);
+        }
+    }
+
+    Heap& arena()
+    {
+        return *arena_;
+    }
+
+    MarkBitmap& marks()
+    {
+        return *marks_;
+    }
+
+    // Values in the region with non-trivial destructors, in address order.
+    std::vector<ValuePtr>& finalizable()
+    {
+        return finalizable_;
+    }
+
+    // Frames and values from outside of the region that have had references
+    // to values in the region stored into them. Each is only remembered
+    // once, see Environment::regionVisit() and Value::remembered().
+    std::vector<EnvPtr>& rememberedFrames()
+    {
+        return rememberedFrames_;
+    }
+
+    std::vector<ValuePtr>& rememberedValues()
+    {
+        return rememberedValues_;
+    }
+
+    // Discards everything in the arena, once the values still in use have
+    // been moved out, and carries on allocating from the start of it. As
+    // far as the write barrier is concerned, it's a new region.
+    void reset()
+    {
+        marks_->clear(arena_->size());
+        arena_->compacted(arena_->size());
+        for (auto& val : rememberedValues_) {
+            val->setRemembered(false);
+        }
+        rememberedValues_.clear();
+        rememberedFrames_.clear();
+        finalizable_.clear();
+        ++serial_;
+    }
+
+    // Discards everything in the arena. The arena stays mapped for the next
+    // region, but if more than releaseThreshold bytes were used, the pages
+    // are given back to the operating system.
+    void close(size_t releaseThreshold)
+    {
+        const auto top = arena_->end();
+        reset();
+        if (size_t(top - arena_->begin()) >= releaseThreshold) {
+            arena_->release(top);
+        }
+        open_ = false;
+    }
+
+private:
+    const size_t capacity_;
+    std::unique_ptr<Heap> arena_;
+    std::unique_ptr<MarkBitmap> marks_;
+    std::vector<ValuePtr> finalizable_;
+    std::vector<EnvPtr> rememberedFrames_;
+    std::vector<ValuePtr> rememberedValues_;
+    size_t serial_ = 0;
+    bool open_ = false;
+};
+
+} // namespace ebl
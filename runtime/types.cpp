@@ -1,11 +1,13 @@
 #include "types.hpp"
 #include "bytecode.hpp"
 #include "ebl.hpp"
+#include "utf8.hpp"
 #include "utility.hpp"
 #include "vm.hpp"
 #include <map>
 #include <memory>
-#include <bitset>
+#include <algorithm>
+#include <cstring>
 
 namespace ebl {
 
@@ -33,6 +35,25 @@ bool EqualTo::operator()(ValuePtr lhs, ValuePtr rhs) const
     return true;
 }
 
+size_t Hash::operator()(ValuePtr val) const noexcept
+{
+    switch (val->typeId()) {
+    case typeId<Integer>():
+        return input<Integer>(val.cast<Integer>()->value());
+    case typeId<Float>():
+        return input<Float>(val.cast<Float>()->value());
+    case typeId<Character>():
+        return input<Character>(val.cast<Character>()->value());
+    case typeId<String>(): {
+        auto str = val.cast<String>();
+        return input<String>(std::string(str->data(), str->bytes()));
+    }
+    default:
+        // Everything else, e.g. a Symbol, is only equal to itself.
+        return std::hash<Value*>{}(val.get());
+    }
+}
+
 ValuePtr Function::call(Arguments& params)
 {
     switch (model_) {
@@ -45,6 +66,8 @@ ValuePtr Function::call(Arguments& params)
         ctx->callStack().push_back(
             {ctx->getProgram().size() - 1, bytecodeAddress_, derived});
         VM::execute(*derived, ctx->getProgram(), bytecodeAddress_);
+        // The function may have been moved by a collection by now, so only
+        // locals are used from here on.
         auto ret = ctx->operandStack().back();
         // The bytecode function would have taken the args off of the
         // operand stack, so we need to clear out the argument
@@ -63,6 +86,9 @@ ValuePtr Function::call(Arguments& params)
                                        std::to_string(requiredArgs_) + " got " +
                                        std::to_string(params.count()));
         }
+        Context* const ctx = envPtr_->getContext();
+        HandleScope scope(*envPtr_);
+        ExecutionSiteScope native(*ctx, {ctx->executionSite().ip_, nativeFn_});
         return (*nativeFn_)(*envPtr_, params);
     } break;
     }
@@ -120,88 +146,166 @@ String::String(const Input& str, Encoding enc)
     initialize(str.c_str(), str.length(), enc);
 }
 
+String::String(String&& other)
+    : data_(other.data_), bytes_(other.bytes_), length_(other.length_)
+{
+    other.data_ = nullptr;
+    other.bytes_ = 0;
+    other.length_ = 0;
+}
+
+String::~String()
+{
+    free(data_);
+}
+
 void String::initialize(const char* data, size_t len, Encoding enc)
 {
-    switch (enc) {
-    case Encoding::binary: {
-        storage_.init(len * sizeof(Character));
-        for (size_t i = 0; i < len; ++i) {
-            auto charMem = storage_.alloc<Character>();
-            new (charMem.cast<Character>().get()) Character({data[i], 0, 0, 0});
+    bytes_ = len;
+    // Validating the text also builds the index, which only strings with
+    // multibyte glyphs need.
+    std::vector<size_t> offsets;
+    length_ = enc == Encoding::utf8
+                  ? indexUtf8(data, len, indexStride, &offsets)
+                  : len;
+    if (ascii()) {
+        data_ = (char*)malloc(std::max(len, size_t(1)));
+        if (not data_) {
+            throw std::bad_alloc();
         }
-    } break;
-
-    case Encoding::utf8: {
-        storage_.init(utf8Len(data, len) * sizeof(Character));
-        foreachUtf8Glyph(
-            [&](const Character::Rep& val) {
-                auto charMem = storage_.alloc<Character>();
-                new (charMem.cast<Character>().get()) Character(val);
-            },
-            data, len);
-    } break;
+        std::memcpy(data_, data, len);
+        return;
     }
+    data_ = (char*)malloc(indexOffset() + offsets.size() * sizeof(size_t));
+    if (not data_) {
+        throw std::bad_alloc();
+    }
+    std::memcpy(data_, data, len);
+    std::copy(offsets.begin(), offsets.end(), (size_t*)(data_ + indexOffset()));
 }
 
 bool String::operator==(const Input& other) const
 {
-    auto glyphs = reinterpret_cast<Character*>(storage_.begin());
-    size_t index = 0;
-    bool equal = true;
-    foreachUtf8Glyph(
-        [&](const Character::Rep& val) {
-            if (glyphs[index].value() != val) {
-                equal = false;
-            }
-            index += 1;
-        },
-        other.c_str(), other.length());
-    return equal;
+    if (bytes_ not_eq other.length() or
+        std::memcmp(data_, other.data(), bytes_) not_eq 0) {
+        return false;
+    }
+    // The same bytes decode to different glyphs in a binary string, unless
+    // they're all ASCII.
+    return not ascii() or asciiRun(other.data(), other.size()) == bytes_;
 }
 
 bool String::operator==(const String& other) const
 {
-    const auto lhsLen = length();
-    const auto rhsLen = other.length();
-    if (lhsLen != rhsLen) {
-        return false;
+    return length_ == other.length_ and bytes_ == other.bytes_ and
+           std::memcmp(data_, other.data_, bytes_) == 0;
+}
+
+std::string String::toAscii() const
+{
+    if (ascii()) {
+        return std::string(data_, bytes_);
     }
-    auto glyphs = reinterpret_cast<Character*>(storage_.begin());
-    auto otherGlyphs = reinterpret_cast<Character*>(other.storage_.begin());
-    for (size_t i = 0; i < lhsLen and i < rhsLen; ++i) {
-        if (glyphs[i].value() not_eq otherGlyphs[i].value()) {
-            return false;
-        }
+    throw std::runtime_error("failed to convert String to ascii");
+}
+
+Character::Rep String::operator[](size_t index) const
+{
+    if (index >= length_) {
+        throw std::runtime_error("invalid index to String");
     }
-    return true;
+    Character::Rep glyph{{0, 0, 0, 0}};
+    if (ascii()) {
+        glyph[0] = data_[index];
+        return glyph;
+    }
+    const size_t start = offset(index);
+    std::copy(data_ + start, data_ + start + utf8GlyphSize(data_[start]),
+              glyph.begin());
+    return glyph;
 }
 
-std::string String::toAscii() const
+size_t String::offset(size_t index) const
 {
-    std::string ret;
-    const auto len = length();
-    auto glyphs = reinterpret_cast<Character*>(storage_.begin());
-    for (size_t i = 0; i < len; ++i) {
-        if (glyphs[i].value()[1] == 0) {
-            ret.push_back(glyphs[i].value()[0]);
-        } else {
-            throw std::runtime_error("failed to convert String to ascii");
-        }
+    if (index == length_) {
+        return bytes_;
+    }
+    if (ascii()) {
+        return index;
+    }
+    size_t offset = glyphIndex()[index / indexStride];
+    for (size_t i = index % indexStride; i > 0; --i) {
+        offset += utf8GlyphSize(data_[offset]);
+    }
+    return offset;
+}
+
+size_t String::glyphAt(size_t offset) const
+{
+    if (ascii()) {
+        return offset;
+    }
+    const auto index = glyphIndex();
+    const size_t block =
+        std::upper_bound(index, index + indexSize(), offset) - index - 1;
+    size_t glyph = block * indexStride;
+    for (size_t i = index[block]; i < offset; i += utf8GlyphSize(data_[i])) {
+        ++glyph;
     }
-    return ret;
+    return glyph;
+}
+
+// Counts the bytes that begin a glyph, i.e. that aren't UTF-8 continuation
+// bytes.
+static size_t glyphCount(const std::string& text)
+{
+    return std::count_if(text.begin(), text.end(),
+                         [](char c) { return (c & 0xc0) not_eq 0x80; });
+}
+
+StringBuilder::StringBuilder(const Input& text)
+    : suffix_(text), length_(glyphCount(text))
+{
+}
+
+void StringBuilder::append(const std::string& text)
+{
+    suffix_ += text;
+    length_ += glyphCount(text);
+}
+
+void StringBuilder::prepend(const std::string& text)
+{
+    prefix_.append(text.rbegin(), text.rend());
+    length_ += glyphCount(text);
 }
 
-size_t String::length() const
+void StringBuilder::appendTo(std::string& out) const
 {
-    return storage_.capacity() / sizeof(Character);
+    out.append(prefix_.rbegin(), prefix_.rend());
+    out += suffix_;
 }
 
-Heap::Ptr<Character> String::operator[](size_t index) const
+std::string StringBuilder::slice(size_t begin, size_t end) const
 {
-    if (index < length()) {
-        return storage_.arrayElemAt<Character>(index);
+    if (begin > end or end > length_) {
+        throw std::runtime_error("invalid slice of StringBuilder");
+    }
+    std::string text;
+    appendTo(text);
+    size_t glyph = 0;
+    size_t first = text.size();
+    for (size_t i = 0; i < text.size(); ++i) {
+        if ((text[i] & 0xc0) not_eq 0x80) {
+            if (glyph == begin) {
+                first = i;
+            }
+            if (glyph++ == end) {
+                return text.substr(first, i - first);
+            }
+        }
     }
-    throw std::runtime_error("invalid index to String");
+    return text.substr(first);
 }
 
 Heap::Ptr<Value> Object::getAttr(Environment& env,
@@ -224,11 +328,14 @@ void Object::setAttr(Environment& env,
 
 std::ostream& operator<<(std::ostream& out, const String& str)
 {
-    const auto len = str.length();
-    for (size_t i = 0; i < len; ++i) {
-        out << *str[i];
-    }
-    return out;
+    return out.write(str.data(), str.bytes());
+}
+
+std::ostream& operator<<(std::ostream& out, const StringBuilder& builder)
+{
+    std::string text;
+    builder.appendTo(text);
+    return out << text;
 }
 
 std::ostream& operator<<(std::ostream& out, const Character& c)
@@ -285,7 +392,7 @@ std::vector<ValuePtr>::iterator Arguments::end() const
     return begin() + count_;
 }
 
-ValuePtr Arguments::operator[](size_t index) const
+ValuePtr& Arguments::operator[](size_t index) const
 {
     return ctx_->operandStack()[startIdx_ + index];
 }
@@ -337,6 +444,13 @@ Heap::Ptr<Character> Character::clone(Environment& env) const
     return env.create<Character>(value_);
 }
 
+Heap::Ptr<StringBuilder> StringBuilder::clone(Environment& env) const
+{
+    std::string text;
+    appendTo(text);
+    return env.create<StringBuilder>(text);
+}
+
 Heap::Ptr<String> String::clone(Environment& env) const
 {
     throw std::runtime_error("Deep clone unimplemented for String");
@@ -2,6 +2,7 @@
 
 #include <array>
 #include <complex>
+#include <cstring>
 #include <functional>
 #include <limits>
 #include <memory>
@@ -31,29 +32,41 @@ class Value {
 private:
     struct Header {
         const TypeId typeInfoIndex;
-        uint8_t marked : 1;
-        uint8_t reserved : 7;
+        uint8_t cdrCoded : 1;
+        uint8_t remembered : 1;
+        uint8_t reserved : 6;
     } header_;
 
+protected:
+    inline void setCdrCoded()
+    {
+        header_.cdrCoded = true;
+    }
+
 public:
-    inline Value(TypeId id) : header_{id, 0, 0}
+    inline Value(TypeId id) : header_{id, 0, 0, 0}
     {
     }
     inline TypeId typeId() const
     {
         return header_.typeInfoIndex;
     }
-    inline void mark()
+
+    // Only ever set for Pairs, see Pair::cdrCodedSize.
+    inline bool cdrCoded() const
     {
-        header_.marked = true;
+        return header_.cdrCoded;
     }
-    inline void unmark()
+
+    // Set while the value is on an open region's remembered list, see
+    // Region::rememberedValues().
+    inline bool remembered() const
     {
-        header_.marked = false;
+        return header_.remembered;
     }
-    inline bool marked() const
+    inline void setRemembered(bool remembered)
     {
-        return header_.marked;
+        header_.remembered = remembered;
     }
 };
 
@@ -97,6 +110,14 @@ struct EqualTo {
 
 struct Hash {
     size_t operator()(ValuePtr val) const noexcept;
+
+    // Hashes the Input that a value of type T is created from, consistently
+    // with the hash of the created value, see storeI().
+    template <typename T>
+    static size_t input(const typename T::Input& val) noexcept
+    {
+        return std::hash<typename T::Input>{}(val);
+    }
 };
 
 
@@ -124,12 +145,33 @@ public:
 };
 
 
+// Lists built all at once (see Context::createList()) are cdr-coded: the
+// cells are allocated contiguously, and every cell but the last is stored
+// without its cdr field, which is implied to be the cell that immediately
+// follows it. Such a cell takes cdrCodedSize bytes rather than sizeof(Pair).
+// Pairs are never modified once constructed, so a cdr-coded cell never needs
+// a cdr of its own, and a live cdr-coded cell keeps the next cell alive,
+// which keeps the cells adjacent through compaction.
 class alignas(8) Pair : public ValueTemplate<Pair> {
 public:
+    struct CdrNext {
+    };
+
+    static constexpr const size_t cdrCodedSize =
+        alignUp(alignUp(sizeof(Value), alignof(HeapRef<Value>)) +
+                    sizeof(HeapRef<Value>),
+                Heap::Align);
+
     inline Pair(ValuePtr car, ValuePtr cdr) : car_(car), cdr_(cdr)
     {
     }
 
+    // Constructs a cdr-coded cell, which must be followed by another Pair.
+    inline Pair(ValuePtr car, CdrNext) : car_(car)
+    {
+        setCdrCoded();
+    }
+
     static constexpr const char* name()
     {
         return "<Pair>";
@@ -142,24 +184,39 @@ public:
 
     inline ValuePtr getCdr() const
     {
+        if (cdrCoded()) {
+            return Heap::wrap((uint8_t*)this + cdrCodedSize)
+                .template cast<Value>();
+        }
         return cdr_;
     }
 
+    // NOTE: Outside of the collector, stores into an existing Pair need to
+    // be preceded by a call to Context::writeBarrier() for the new value.
     inline void setCar(ValuePtr value)
     {
         car_ = value;
     }
 
+    // Not for cdr-coded cells.
     inline void setCdr(ValuePtr value)
     {
         cdr_ = value;
     }
 
+    static void relocate(Value* val, uint8_t* dest)
+    {
+        std::memmove(dest, val, val->cdrCoded() ? cdrCodedSize : sizeof(Pair));
+    }
+
     Heap::Ptr<Pair> clone(Environment& env) const;
 
 private:
-    ValuePtr car_;
-    ValuePtr cdr_;
+    HeapRef<Value> car_;
+    // A cdr-coded cell ends before the cdr, so it's left unconstructed.
+    union {
+        HeapRef<Value> cdr_;
+    };
 };
 
 
@@ -175,6 +232,7 @@ class alignas(8) Box : public ValueTemplate<Box> {
         return "<Box>";
     }
 
+    // NOTE: see the comment above Pair::setCar() regarding write barriers.
     void set(ValuePtr value)
     {
         value_ = value;
@@ -188,7 +246,7 @@ class alignas(8) Box : public ValueTemplate<Box> {
     Heap::Ptr<Box> clone(Environment& env) const;
 
  private:
-    ValuePtr value_;
+    HeapRef<Value> value_;
 };
 
 
@@ -324,6 +382,15 @@ private:
 };
 
 
+template <>
+inline size_t Hash::input<Character>(const Character::Input& val) noexcept
+{
+    uint32_t bits;
+    std::memcpy(&bits, val.data(), sizeof bits);
+    return std::hash<uint32_t>{}(bits);
+}
+
+
 class alignas(8) String : public ValueTemplate<String> {
 public:
     using Input = std::string;
@@ -338,14 +405,49 @@ public:
         return *this;
     }
 
+    // With the binary encoding, each byte is a glyph of its own.
     enum class Encoding { binary, utf8 };
 
     String(const char* data, size_t length, Encoding enc = Encoding::utf8);
     String(const Input& str, Encoding enc = Encoding::utf8);
+    String(String&& other);
+    String(const String&) = delete;
+    ~String();
+
+    // Returns a copy of the glyph at index, see Character::Rep.
+    Character::Rep operator[](size_t index) const;
+
+    // The byte offset of the glyph at index, or bytes(), for index ==
+    // length().
+    size_t offset(size_t index) const;
+
+    // The index of the glyph that begins at byte offset, the inverse of
+    // offset().
+    size_t glyphAt(size_t offset) const;
+
+    // The number of glyphs.
+    size_t length() const
+    {
+        return length_;
+    }
+
+    // True when every glyph is a single byte, i.e. the string is ASCII, or
+    // binary. Indexing such a string doesn't need to decode anything.
+    bool ascii() const
+    {
+        return length_ == bytes_;
+    }
 
-    Heap::Ptr<Character> operator[](size_t index) const;
+    // The string's UTF-8 encoded bytes.
+    const char* data() const
+    {
+        return data_;
+    }
 
-    size_t length() const;
+    size_t bytes() const
+    {
+        return bytes_;
+    }
 
     std::string toAscii() const;
 
@@ -354,9 +456,83 @@ public:
 
     Heap::Ptr<String> clone(Environment& env) const;
 
+    // Bytes allocated outside of the heap, for the text and its index.
+    size_t storageSize() const
+    {
+        return ascii() ? bytes_ : indexOffset() + indexSize() * sizeof(size_t);
+    }
+
 private:
     void initialize(const char* data, size_t len, Encoding enc);
-    Heap storage_;
+
+    // A string with multibyte glyphs stores the byte offset of every
+    // indexStride'th glyph after its text, so that finding a glyph only
+    // needs to decode the glyphs after the nearest indexed one.
+    static constexpr const size_t indexStride = 32;
+
+    size_t indexOffset() const
+    {
+        return alignUp(bytes_, alignof(size_t));
+    }
+
+    size_t indexSize() const
+    {
+        return (length_ + indexStride - 1) / indexStride;
+    }
+
+    const size_t* glyphIndex() const
+    {
+        return reinterpret_cast<const size_t*>(data_ + indexOffset());
+    }
+
+    char* data_;
+    size_t bytes_;
+    size_t length_;
+};
+
+
+// A StringBuilder accumulates text for a String, see the string-builder
+// builtin. Appending or prepending costs time in proportion to the text
+// added, so building a string piece by piece is linear, where concatenating
+// Strings copies everything built so far at each step.
+class alignas(8) StringBuilder : public ValueTemplate<StringBuilder> {
+public:
+    using Input = std::string;
+
+    StringBuilder(const Input& text);
+
+    static constexpr const char* name()
+    {
+        return "<StringBuilder>";
+    }
+
+    void append(const std::string& text);
+    void prepend(const std::string& text);
+
+    // The number of glyphs.
+    size_t length() const
+    {
+        return length_;
+    }
+
+    size_t bytes() const
+    {
+        return prefix_.size() + suffix_.size();
+    }
+
+    // Appends the builder's text to out.
+    void appendTo(std::string& out) const;
+
+    // The text of the glyphs from begin up to end.
+    std::string slice(size_t begin, size_t end) const;
+
+    Heap::Ptr<StringBuilder> clone(Environment& env) const;
+
+private:
+    // Prepended text is kept in reverse, so that prepending appends too.
+    std::string prefix_;
+    std::string suffix_;
+    size_t length_;
 };
 
 
@@ -386,7 +562,7 @@ public:
     Heap::Ptr<Symbol> clone(Environment& env) const;
 
 private:
-    Heap::Ptr<String> str_;
+    HeapRef<String> str_;
 };
 
 
@@ -451,7 +627,9 @@ public:
 
     void push(ValuePtr arg);
 
-    ValuePtr operator[](size_t index) const;
+    // The argument's slot on the operand stack, which the collector keeps
+    // up to date, so it can be passed straight to Environment::create().
+    ValuePtr& operator[](size_t index) const;
 
     void consumed();
 
@@ -546,6 +724,11 @@ public:
         return model_;
     }
 
+    CFunction nativeFunction() const
+    {
+        return nativeFn_;
+    }
+
 private:
     InvocationModel model_;
     ValuePtr docstring_;
@@ -559,7 +742,7 @@ private:
 struct TypeInfo {
     size_t size_;
     const char* name_;
-    void (*finalizer)(Value*);
+    void (*finalizer)(Value*); // Null for trivially destructible types
     void (*relocatePolicy)(Value*, uint8_t*);
     ValuePtr (*clonePolicy)(Environment&, ValuePtr);
 };
@@ -567,8 +750,10 @@ struct TypeInfo {
 
 template <typename T> constexpr TypeInfo makeInfo()
 {
-    return TypeInfo{sizeof(T), T::name(), T::finalize, T::relocate,
-                    T::cloneInterface};
+    return TypeInfo{sizeof(T), T::name(),
+                    std::is_trivially_destructible<T>::value ? nullptr
+                                                             : T::finalize,
+                    T::relocate, T::cloneInterface};
 }
 
 
@@ -596,15 +781,27 @@ template <typename... Builtins> struct TypeInfoTable {
 
 
 constexpr TypeInfoTable<Null, Pair, Boolean, Integer, Float, Complex, String,
-                        Character, Symbol, RawPointer, Function, Box, Object>
+                        Character, Symbol, RawPointer, Function, Box, Object,
+                        StringBuilder>
     typeInfoTable;
 
 
+constexpr size_t typeCount =
+    sizeof(typeInfoTable.table) / sizeof(typeInfoTable.table[0]);
+
+
 template <typename Ptr> const TypeInfo& typeInfo(Ptr val)
 {
     return typeInfoTable[val->typeId()];
 }
 
+// The number of bytes that a value occupies, which for a cdr-coded Pair is
+// less than the size of its type.
+template <typename Ptr> size_t valueSize(Ptr val)
+{
+    return val->cdrCoded() ? Pair::cdrCodedSize : typeInfo(val).size_;
+}
+
 
 template <typename T> constexpr TypeId typeId()
 {
@@ -640,5 +837,6 @@ template <typename T> Heap::Ptr<T> checkedCast(ValuePtr val)
 
 std::ostream& operator<<(std::ostream& out, const String& str);
 std::ostream& operator<<(std::ostream& out, const Character& c);
+std::ostream& operator<<(std::ostream& out, const StringBuilder& builder);
 
 } // namespace ebl
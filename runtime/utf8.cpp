@@ -0,0 +1,101 @@
+#include "utf8.hpp"
+#include <cstring>
+#include <stdexcept>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace ebl {
+
+size_t asciiRun(const char* data, size_t len)
+{
+    size_t i = 0;
+#if defined(__AVX2__)
+    for (; i + 32 <= len; i += 32) {
+        const __m256i chunk = _mm256_loadu_si256((const __m256i*)(data + i));
+        const uint32_t high = _mm256_movemask_epi8(chunk);
+        if (high) {
+            return i + __builtin_ctz(high);
+        }
+    }
+#elif defined(__SSE2__)
+    // Four vectors at a time, which keeps up with memory, and then one at a
+    // time to find which of them had the non-ASCII byte.
+    for (; i + 64 <= len; i += 64) {
+        const auto p = (const __m128i*)(data + i);
+        const __m128i low =
+            _mm_or_si128(_mm_loadu_si128(p), _mm_loadu_si128(p + 1));
+        const __m128i high =
+            _mm_or_si128(_mm_loadu_si128(p + 2), _mm_loadu_si128(p + 3));
+        const __m128i any = _mm_or_si128(low, high);
+        if (_mm_movemask_epi8(any)) {
+            break;
+        }
+    }
+    for (; i + 16 <= len; i += 16) {
+        const __m128i chunk = _mm_loadu_si128((const __m128i*)(data + i));
+        const unsigned high = _mm_movemask_epi8(chunk);
+        if (high) {
+            return i + __builtin_ctz(high);
+        }
+    }
+#endif
+    // The rest, or without SIMD, all of it, eight bytes at a time.
+    const uint64_t highBits = 0x8080808080808080;
+    for (; i + 8 <= len; i += 8) {
+        uint64_t word;
+        std::memcpy(&word, data + i, sizeof word);
+        if (word & highBits) {
+            break;
+        }
+    }
+    for (; i < len; ++i) {
+        if (data[i] & 0x80) {
+            return i;
+        }
+    }
+    return len;
+}
+
+size_t indexUtf8(const char* data, size_t len, size_t stride,
+                 std::vector<size_t>* offsets)
+{
+    size_t pos = asciiRun(data, len);
+    if (pos == len) {
+        return len;
+    }
+    size_t glyphs = 0;
+    size_t run = pos;
+    while (true) {
+        // Within a run of ASCII, glyphs and bytes line up, so the offsets
+        // can be worked out without looking at the text.
+        if (offsets) {
+            const size_t first = (glyphs + stride - 1) / stride * stride;
+            for (size_t glyph = first; glyph < glyphs + run; glyph += stride) {
+                offsets->push_back(pos - run + (glyph - glyphs));
+            }
+        }
+        glyphs += run;
+        if (pos == len) {
+            return glyphs;
+        }
+        do {
+            const size_t size = utf8SequenceSize(data + pos, len - pos);
+            if (size == 0) {
+                throw std::runtime_error("failed to parse unicode string");
+            }
+            if (offsets and glyphs % stride == 0) {
+                offsets->push_back(pos);
+            }
+            pos += size;
+            ++glyphs;
+        } while (pos < len and (data[pos] & 0x80));
+        run = asciiRun(data + pos, len - pos);
+        pos += run;
+    }
+}
+
+} // namespace ebl
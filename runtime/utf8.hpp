@@ -0,0 +1,53 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+namespace ebl {
+
+// The number of ASCII bytes at the start of data, i.e. the offset of the
+// first byte with its high bit set, or len. Scans with SIMD where the
+// target has it.
+size_t asciiRun(const char* data, size_t len);
+
+// The size of the well formed UTF-8 sequence at the start of data, or zero
+// if it's truncated, overlong, a surrogate, or beyond U+10FFFF.
+inline size_t utf8SequenceSize(const char* data, size_t len)
+{
+    const auto lead = (uint8_t)data[0];
+    const auto follows = [&](size_t i, uint8_t low, uint8_t high) {
+        return i < len and (uint8_t)data[i] >= low and (uint8_t)data[i] <= high;
+    };
+    if (lead < 0x80) {
+        return 1;
+    } else if (lead < 0xc2) {
+        return 0;
+    } else if (lead < 0xe0) {
+        return follows(1, 0x80, 0xbf) ? 2 : 0;
+    } else if (lead < 0xf0) {
+        const bool valid = follows(1, lead == 0xe0 ? 0xa0 : 0x80,
+                                   lead == 0xed ? 0x9f : 0xbf) and
+                           follows(2, 0x80, 0xbf);
+        return valid ? 3 : 0;
+    } else if (lead < 0xf5) {
+        const bool valid = follows(1, lead == 0xf0 ? 0x90 : 0x80,
+                                   lead == 0xf4 ? 0x8f : 0xbf) and
+                           follows(2, 0x80, 0xbf) and follows(3, 0x80, 0xbf);
+        return valid ? 4 : 0;
+    }
+    return 0;
+}
+
+// Checks that the len bytes at data are well formed UTF-8, in one pass, and
+// returns the number of glyphs. Throws if they aren't. Unless the text is all
+// ASCII, the byte offset of every stride'th glyph is appended to offsets.
+size_t indexUtf8(const char* data, size_t len, size_t stride,
+                 std::vector<size_t>* offsets);
+
+inline size_t utf8Length(const char* data, size_t len)
+{
+    return indexUtf8(data, len, 1, nullptr);
+}
+
+} // namespace ebl
@@ -1,9 +1,10 @@
 #pragma once
 
 #include <array>
-#include <bitset>
+#include <stdexcept>
 #include <memory>
 #include <stddef.h>
+#include <stdint.h>
 #include <type_traits>
 
 namespace ebl {
@@ -19,6 +20,11 @@ struct Index<T, F, R...>
     : std::integral_constant<size_t, 1 + Index<T, R...>::value> {
 };
 
+constexpr size_t alignUp(size_t size, size_t alignment)
+{
+    return (size + alignment - 1) / alignment * alignment;
+}
+
 template <typename T, typename... Args>
 std::unique_ptr<T> make_unique(Args&&... args)
 {
@@ -47,40 +53,21 @@ auto dynamicWind(Body&& body, After&& after) -> decltype(body())
 
 using WideChar = std::array<char, 4>;
 
-// TODO: replace this function with an iterator or array adaptor
-template <typename F>
-void foreachUtf8Glyph(F&& callback, const char* data, size_t len)
+// The number of bytes in the UTF-8 sequence that begins with lead, or zero
+// if lead can't begin a sequence.
+inline size_t utf8GlyphSize(char lead)
 {
-    size_t index = 0;
-    while (index < len) {
-        const std::bitset<8> parsed(data[index]);
-        if (parsed[7] == 0) {
-            callback(WideChar{{data[index], 0, 0, 0}});
-            index += 1;
-        } else if (parsed[7] == 1 and parsed[6] == 1 and parsed[5] == 0) {
-            callback(WideChar{{data[index], data[index + 1], 0, 0}});
-            index += 2;
-        } else if (parsed[7] == 1 and parsed[6] == 1 and parsed[5] == 1 and
-                   parsed[4] == 0) {
-            callback(
-                WideChar{{data[index], data[index + 1], data[index + 2], 0}});
-            index += 3;
-        } else if (parsed[7] == 1 and parsed[6] == 1 and parsed[5] == 1 and
-                   parsed[4] == 1 and parsed[3] == 0) {
-            callback(WideChar{{data[index], data[index + 1], data[index + 2],
-                               data[index + 3]}});
-            index += 4;
-        } else {
-            throw std::runtime_error("failed to parse unicode string");
-        }
+    const auto byte = (uint8_t)lead;
+    if (byte < 0x80) {
+        return 1;
+    } else if ((byte & 0xe0) == 0xc0) {
+        return 2;
+    } else if ((byte & 0xf0) == 0xe0) {
+        return 3;
+    } else if ((byte & 0xf8) == 0xf0) {
+        return 4;
     }
-}
-
-inline size_t utf8Len(const char* data, size_t len)
-{
-    size_t ret = 0;
-    foreachUtf8Glyph([&ret](const WideChar&) { ++ret; }, data, len);
-    return ret;
+    return 0;
 }
 
 } // namespace ebl
@@ -1,8 +1,7 @@
 #include "vm.hpp"
 #include "bytecode.hpp"
 #include "ebl.hpp"
-#include "listBuilder.hpp"
-#include "persistent.hpp"
+#include "handle.hpp"
 
 
 namespace ebl {
@@ -44,6 +43,7 @@ InstructionAddress VM::execute(Environment& environment,
     auto& operandStack = context->operandStack();
     auto& callStack = context->callStack();
     size_t ip = start;
+    ExecutionSiteScope siteScope(*context, {&ip, nullptr});
 #ifndef NO_DIRECT_THREADING
     static const std::array<void*, (uint8_t)Opcode::Count> labels = {
         &&Exit,
@@ -142,6 +142,7 @@ InstructionAddress VM::execute(Environment& environment,
 
     VM_BLOCK_BEGIN(Call)
     {
+        context->safepoint(*env);
         ++ip;
         auto argc = readParam<uint8_t>(bc, ip);
         auto target = operandStack.back();
@@ -161,6 +162,9 @@ InstructionAddress VM::execute(Environment& environment,
         case Function::InvocationModel::Wrapped: {
             auto result = env->getNull();
             {
+                HandleScope scope(*env);
+                ExecutionSiteScope native(
+                    *context, {&ip, fn->nativeFunction()});
                 Arguments args(*env, argc);
                 operandStack.pop_back();
                 result = fn->directCall(args);
@@ -170,19 +174,24 @@ InstructionAddress VM::execute(Environment& environment,
 
         case Function::InvocationModel::BytecodeVariadic: {
             const auto addr = fn->getBytecodeAddress();
-            Persistent<Function> toCall(*env, fn);
+            HandleScope scope(*env);
+            Handle<Function> toCall(*env, fn);
             operandStack.pop_back();
             if (UNLIKELY(argc < fn->argCount() - 1)) {
                 failedToApply(*env, fn.get(), argc, fn->argCount());
                 throw std::runtime_error("insufficient arguments to VA fn");
             }
             {
-                LazyListBuilder builder(*env);
-                for (size_t i = 0; i < argc - (fn->argCount() - 1); ++i) {
-                    builder.pushFront(operandStack.back());
-                    operandStack.pop_back();
-                }
-                operandStack.push_back(builder.result());
+                // The rest arguments are already rooted on the operand
+                // stack, in order, so they're packed from there directly.
+                const size_t restCount = argc - (fn->argCount() - 1);
+                const size_t restBegin = operandStack.size() - restCount;
+                auto rest = env->createList(restCount, [&](size_t i) {
+                    return operandStack[restBegin + i];
+                });
+                operandStack.erase(operandStack.begin() + restBegin,
+                                   operandStack.end());
+                operandStack.push_back(rest);
             }
             env = toCall->definitionEnvironment()->derive();
             callStack.push_back({ip, addr, env});
@@ -195,6 +204,7 @@ InstructionAddress VM::execute(Environment& environment,
 
     VM_BLOCK_BEGIN(Recur)
     {
+        context->safepoint(*env);
         ++ip;
         env->getVars().clear();
         ip = callStack.back().functionTop_;
@@ -2,15 +2,36 @@
 #include <iostream>
 #include <sstream>
 #include <chrono>
+#include <cstdlib>
+#include <cstring>
 #include "runtime/ebl.hpp"
 
 
 int main(int argc, char** argv)
 {
-    if (argc != 2) {
-        std::cout << "usage: dofile <fname>" << std::endl;
+    if (argc < 2) {
+        std::cout << "usage: dofile <fname> [--segregated-heap]"
+                  << " [--gc-threads <n>] [--gc-slice <n>] [--region]"
+                  << std::endl;
+    }
+    auto config = ebl::Context::defaultConfig();
+    bool region = false;
+    for (int i = 2; i < argc; ++i) {
+        if (std::strcmp(argv[i], "--segregated-heap") == 0) {
+            using Layout = ebl::Context::Configuration::HeapLayout;
+            config.heapLayout_ = Layout::segregated;
+        } else if (std::strcmp(argv[i], "--gc-threads") == 0 and
+                   i + 1 < argc) {
+            config.gcThreads_ = std::atoi(argv[++i]);
+        } else if (std::strcmp(argv[i], "--gc-slice") == 0 and
+                   i + 1 < argc) {
+            // Marks incrementally, tracing at most n values per slice.
+            config.gcSliceBudget_ = std::atoi(argv[++i]);
+        } else if (std::strcmp(argv[i], "--region") == 0) {
+            region = true;
+        }
     }
-    ebl::Context context;
+    ebl::Context context(config);
     auto& env = context.topLevel();
     std::ifstream t(argv[1]);
     std::stringstream buffer;
@@ -20,7 +41,16 @@ int main(int argc, char** argv)
     try {
         using namespace std::chrono;
         auto start = high_resolution_clock::now();
+        if (region) {
+            context.openRegion();
+        }
         env.exec(buffer.str());
+        if (region) {
+            const auto stat = context.closeRegion();
+            std::cout << "\nregion: " << stat.allocated_
+                      << " bytes allocated, " << stat.promoted_
+                      << " promoted" << std::endl;
+        }
         auto stop = high_resolution_clock::now();
         std::cout << "\nexecution finished in "
                   << duration_cast<nanoseconds>(stop - start).count()
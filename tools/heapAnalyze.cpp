@@ -0,0 +1,439 @@
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "runtime/heapSnapshot.hpp"
+
+// Reads a heap snapshot written by Context::writeHeapSnapshot(), and reports
+// per-type counts and sizes, along with the values that retain the most
+// memory. A value's retained size is the memory that would be freed if the
+// value were collected, i.e. the size of everything it dominates in the
+// reference graph, which is computed with the iterative algorithm from
+// Cooper, Harvey, and Kennedy, "A Simple, Fast Dominance Algorithm".
+
+using namespace ebl;
+
+namespace {
+
+class Reader {
+public:
+    Reader(const std::string& fname) : in_(fname, std::ifstream::binary)
+    {
+        if (not in_) {
+            throw std::runtime_error("failed to open " + fname);
+        }
+    }
+
+    template <typename T> T read()
+    {
+        T val;
+        in_.read((char*)&val, sizeof val);
+        if (not in_) {
+            throw std::runtime_error("truncated snapshot");
+        }
+        return val;
+    }
+
+    std::string readString(size_t len)
+    {
+        std::string str(len, '\0');
+        in_.read(&str[0], len);
+        if (not in_) {
+            throw std::runtime_error("truncated snapshot");
+        }
+        return str;
+    }
+
+private:
+    std::ifstream in_;
+};
+
+using NodeId = uint32_t;
+const NodeId noNode = -1;
+
+// Node zero is a synthetic root, which references all of the real roots.
+struct Graph {
+    std::vector<std::string> typeNames_;
+    std::vector<uint64_t> address_;
+    std::vector<uint8_t> type_;
+    std::vector<uint64_t> size_;
+    std::vector<size_t> edgeBegin_;
+    std::vector<NodeId> edges_;
+    std::vector<snapshot::RootKind> rootKind_;
+    size_t rootCount_ = 0;
+    size_t danglingRefs_ = 0;
+
+    size_t nodeCount() const
+    {
+        return address_.size();
+    }
+
+    const std::string& typeName(NodeId node) const
+    {
+        static const std::string root = "(roots)";
+        if (node == 0) {
+            return root;
+        }
+        return typeNames_[type_[node]];
+    }
+};
+
+Graph load(const std::string& fname)
+{
+    Reader reader(fname);
+    Graph graph;
+    char magic[sizeof snapshot::magic];
+    for (auto& c : magic) {
+        c = reader.read<char>();
+    }
+    if (memcmp(magic, snapshot::magic, sizeof magic) not_eq 0) {
+        throw std::runtime_error(fname + " is not a heap snapshot");
+    }
+    const auto typeCount = reader.read<uint32_t>();
+    for (uint32_t i = 0; i < typeCount; ++i) {
+        graph.typeNames_.push_back(reader.readString(reader.read<uint32_t>()));
+    }
+    const auto nodeCount = reader.read<uint64_t>();
+    std::vector<uint64_t> refs;
+    graph.address_.push_back(0);
+    graph.type_.push_back(0);
+    graph.size_.push_back(0);
+    graph.edgeBegin_.push_back(0);
+    for (uint64_t i = 0; i < nodeCount; ++i) {
+        graph.address_.push_back(reader.read<uint64_t>());
+        const auto type = reader.read<uint8_t>();
+        if (type >= typeCount) {
+            throw std::runtime_error("bad type id in snapshot");
+        }
+        graph.type_.push_back(type);
+        graph.size_.push_back(reader.read<uint64_t>());
+        graph.edgeBegin_.push_back(refs.size());
+        const auto refCount = reader.read<uint32_t>();
+        for (uint32_t j = 0; j < refCount; ++j) {
+            refs.push_back(reader.read<uint64_t>());
+        }
+    }
+    std::unordered_map<uint64_t, NodeId> index;
+    for (NodeId node = 1; node < graph.nodeCount(); ++node) {
+        index[graph.address_[node]] = node;
+    }
+    auto resolve = [&](uint64_t address) -> NodeId {
+        auto found = index.find(address);
+        if (found == index.end()) {
+            ++graph.danglingRefs_;
+            return noNode;
+        }
+        return found->second;
+    };
+
+    // The roots become the synthetic root's edges, so the edge lists are
+    // assembled once everything has been read.
+    graph.rootCount_ = reader.read<uint64_t>();
+    graph.rootKind_.resize(graph.nodeCount(), snapshot::RootKind::count);
+    std::vector<NodeId> rootEdges;
+    for (size_t i = 0; i < graph.rootCount_; ++i) {
+        const auto kind = (snapshot::RootKind)reader.read<uint8_t>();
+        const auto target = resolve(reader.read<uint64_t>());
+        if (target not_eq noNode) {
+            rootEdges.push_back(target);
+            if (graph.rootKind_[target] == snapshot::RootKind::count) {
+                graph.rootKind_[target] = kind;
+            }
+        }
+    }
+    std::vector<size_t> refBegin;
+    refBegin.swap(graph.edgeBegin_);
+    refBegin.push_back(refs.size());
+    graph.edgeBegin_.push_back(0);
+    graph.edges_ = rootEdges;
+    for (NodeId node = 1; node < graph.nodeCount(); ++node) {
+        graph.edgeBegin_.push_back(graph.edges_.size());
+        for (size_t i = refBegin[node]; i < refBegin[node + 1]; ++i) {
+            const auto target = resolve(refs[i]);
+            if (target not_eq noNode) {
+                graph.edges_.push_back(target);
+            }
+        }
+    }
+    graph.edgeBegin_.push_back(graph.edges_.size());
+    return graph;
+}
+
+struct Dominators {
+    std::vector<NodeId> postorder_;    // Reachable nodes, in postorder
+    std::vector<NodeId> postIndex_;    // Position in postorder_
+    std::vector<NodeId> idom_;         // noNode if unreachable
+    std::vector<uint64_t> retained_;
+};
+
+Dominators computeDominators(const Graph& graph)
+{
+    const size_t count = graph.nodeCount();
+    Dominators result;
+    result.postIndex_.assign(count, noNode);
+    result.idom_.assign(count, noNode);
+
+    // Iterative depth first search, rather than recursion, because lists
+    // make for very deep graphs.
+    std::vector<std::pair<NodeId, size_t>> stack;
+    std::vector<bool> visited(count);
+    stack.push_back({0, graph.edgeBegin_[0]});
+    visited[0] = true;
+    while (not stack.empty()) {
+        auto& top = stack.back();
+        if (top.second < graph.edgeBegin_[top.first + 1]) {
+            const NodeId next = graph.edges_[top.second++];
+            if (not visited[next]) {
+                visited[next] = true;
+                stack.push_back({next, graph.edgeBegin_[next]});
+            }
+        } else {
+            result.postIndex_[top.first] = result.postorder_.size();
+            result.postorder_.push_back(top.first);
+            stack.pop_back();
+        }
+    }
+
+    std::vector<std::vector<NodeId>> preds(count);
+    for (NodeId node : result.postorder_) {
+        for (size_t i = graph.edgeBegin_[node]; i < graph.edgeBegin_[node + 1];
+             ++i) {
+            preds[graph.edges_[i]].push_back(node);
+        }
+    }
+
+    auto& idom = result.idom_;
+    auto& postIndex = result.postIndex_;
+    auto intersect = [&](NodeId a, NodeId b) {
+        while (a not_eq b) {
+            while (postIndex[a] < postIndex[b]) {
+                a = idom[a];
+            }
+            while (postIndex[b] < postIndex[a]) {
+                b = idom[b];
+            }
+        }
+        return a;
+    };
+    idom[0] = 0;
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        // Reverse postorder, skipping the root, which comes last.
+        for (size_t i = result.postorder_.size() - 1; i-- > 0;) {
+            const NodeId node = result.postorder_[i];
+            NodeId newIdom = noNode;
+            for (NodeId pred : preds[node]) {
+                if (idom[pred] == noNode) {
+                    continue;
+                }
+                newIdom = newIdom == noNode ? pred : intersect(pred, newIdom);
+            }
+            if (idom[node] not_eq newIdom) {
+                idom[node] = newIdom;
+                changed = true;
+            }
+        }
+    }
+
+    // A node's dominator always precedes it in reverse postorder, so in
+    // postorder, a node's retained size is complete before it's added to
+    // its dominator's.
+    result.retained_.assign(count, 0);
+    for (NodeId node : result.postorder_) {
+        result.retained_[node] += graph.size_[node];
+        if (node not_eq 0) {
+            result.retained_[idom[node]] += result.retained_[node];
+        }
+    }
+    return result;
+}
+
+struct TypeSummary {
+    size_t count_ = 0;
+    uint64_t shallow_ = 0;
+    uint64_t retained_ = 0;
+    size_t unreachable_ = 0;
+};
+
+// A type's retained size counts each value that isn't dominated by another
+// value of the same type, so that e.g. the pairs in a list aren't counted
+// once for every pair before them.
+std::vector<TypeSummary> summarize(const Graph& graph, const Dominators& dom)
+{
+    std::vector<TypeSummary> types(graph.typeNames_.size());
+    for (NodeId node = 1; node < graph.nodeCount(); ++node) {
+        auto& summary = types[graph.type_[node]];
+        ++summary.count_;
+        summary.shallow_ += graph.size_[node];
+        if (dom.idom_[node] == noNode) {
+            ++summary.unreachable_;
+        }
+    }
+
+    const size_t count = graph.nodeCount();
+    std::vector<size_t> childBegin(count + 1);
+    for (NodeId node : dom.postorder_) {
+        if (node not_eq 0) {
+            ++childBegin[dom.idom_[node] + 1];
+        }
+    }
+    for (size_t i = 0; i < count; ++i) {
+        childBegin[i + 1] += childBegin[i];
+    }
+    std::vector<NodeId> children(childBegin[count]);
+    std::vector<size_t> fill(childBegin.begin(), childBegin.end() - 1);
+    for (NodeId node : dom.postorder_) {
+        if (node not_eq 0) {
+            children[fill[dom.idom_[node]]++] = node;
+        }
+    }
+
+    std::vector<size_t> active(types.size());
+    std::vector<std::pair<NodeId, size_t>> stack;
+    stack.push_back({0, childBegin[0]});
+    while (not stack.empty()) {
+        auto& top = stack.back();
+        if (top.second < childBegin[top.first + 1]) {
+            const NodeId child = children[top.second++];
+            const auto type = graph.type_[child];
+            if (active[type]++ == 0) {
+                types[type].retained_ += dom.retained_[child];
+            }
+            stack.push_back({child, childBegin[child]});
+        } else {
+            if (top.first not_eq 0) {
+                --active[graph.type_[top.first]];
+            }
+            stack.pop_back();
+        }
+    }
+    return types;
+}
+
+std::string describe(const Graph& graph, NodeId node)
+{
+    std::stringstream str;
+    str << graph.typeName(node) << "@0x" << std::hex << graph.address_[node];
+    return str.str();
+}
+
+void printPath(const Graph& graph, const Dominators& dom, NodeId node)
+{
+    std::vector<NodeId> path;
+    for (; node not_eq 0; node = dom.idom_[node]) {
+        path.push_back(node);
+    }
+    std::reverse(path.begin(), path.end());
+    const size_t maxShown = 8;
+    // Values dominated by the synthetic root directly may be reachable from
+    // several roots, rather than referenced by one.
+    const auto kind = graph.rootKind_[path[0]];
+    std::cout << "     "
+              << (kind == snapshot::RootKind::count
+                      ? "(several roots)"
+                      : snapshot::rootKindName(kind));
+    for (size_t i = 0; i < path.size(); ++i) {
+        if (path.size() > maxShown and i == maxShown / 2) {
+            const size_t skipped = path.size() - maxShown;
+            std::cout << " -> ... (" << skipped << " more)";
+            i += skipped;
+        }
+        std::cout << " -> " << describe(graph, path[i]);
+    }
+    std::cout << std::endl;
+}
+
+void report(const Graph& graph, const Dominators& dom, size_t topCount)
+{
+    uint64_t totalSize = 0;
+    uint64_t reachableSize = 0;
+    for (NodeId node = 1; node < graph.nodeCount(); ++node) {
+        totalSize += graph.size_[node];
+        if (dom.idom_[node] not_eq noNode) {
+            reachableSize += graph.size_[node];
+        }
+    }
+    const size_t reachable = dom.postorder_.size() - 1;
+    std::cout << "snapshot: " << graph.nodeCount() - 1 << " nodes, "
+              << totalSize << " bytes, " << graph.rootCount_ << " roots\n"
+              << "reachable: " << reachable << " nodes, " << reachableSize
+              << " bytes\n"
+              << "unreachable: " << graph.nodeCount() - 1 - reachable
+              << " nodes, " << totalSize - reachableSize << " bytes\n"
+              << "references to non-nodes: " << graph.danglingRefs_ << "\n\n";
+
+    const auto types = summarize(graph, dom);
+    std::vector<size_t> order;
+    for (size_t i = 0; i < types.size(); ++i) {
+        if (types[i].count_) {
+            order.push_back(i);
+        }
+    }
+    std::sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+        return types[a].retained_ > types[b].retained_;
+    });
+    std::cout << std::left << std::setw(14) << "type" << std::right
+              << std::setw(12) << "count" << std::setw(14) << "unreachable"
+              << std::setw(14) << "shallow" << std::setw(14) << "retained"
+              << '\n';
+    for (auto i : order) {
+        std::cout << std::left << std::setw(14) << graph.typeNames_[i]
+                  << std::right << std::setw(12) << types[i].count_
+                  << std::setw(14) << types[i].unreachable_ << std::setw(14)
+                  << types[i].shallow_ << std::setw(14) << types[i].retained_
+                  << '\n';
+    }
+
+    // Within a chain of values of the same type, e.g. the pairs in a list,
+    // only the head is reported.
+    std::vector<NodeId> retainers;
+    for (NodeId node : dom.postorder_) {
+        const NodeId idom = dom.idom_[node];
+        if (node not_eq 0 and
+            (idom == 0 or graph.type_[idom] not_eq graph.type_[node])) {
+            retainers.push_back(node);
+        }
+    }
+    topCount = std::min(topCount, retainers.size());
+    std::partial_sort(retainers.begin(), retainers.begin() + topCount,
+                      retainers.end(), [&](NodeId a, NodeId b) {
+                          return dom.retained_[a] > dom.retained_[b];
+                      });
+    std::cout << "\ntop retainers:\n";
+    for (size_t i = 0; i < topCount; ++i) {
+        const NodeId node = retainers[i];
+        std::cout << std::setw(4) << i + 1 << ". " << describe(graph, node)
+                  << " retains " << dom.retained_[node] << " bytes"
+                  << std::endl;
+        printPath(graph, dom, node);
+    }
+}
+
+} // namespace
+
+
+int main(int argc, char** argv)
+{
+    size_t topCount = 10;
+    if (argc == 4 and strcmp(argv[2], "--top") == 0) {
+        topCount = std::stoul(argv[3]);
+    } else if (argc not_eq 2) {
+        std::cout << "usage: ebl-heap-analyze <snapshot> [--top n]"
+                  << std::endl;
+        return 1;
+    }
+    try {
+        const auto graph = load(argv[1]);
+        report(graph, computeDominators(graph), topCount);
+    } catch (const std::exception& ex) {
+        std::cout << "Error:\n" << ex.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}
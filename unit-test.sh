@@ -1,12 +1,15 @@
 #!/bin/bash
 
+# Any arguments are passed along to ebl-dofile, e.g. --gc-slice 64 runs the
+# tests under the incremental collector, and --region runs them in a region.
+
 for filename in ebl/*.test.ebl; do
     echo $filename
-    if ! ./ebl-dofile $filename; then
+    if ! ./ebl-dofile $filename "$@"; then
         exit 1
     fi
 done
 
-if ! ./ebl-dofile "ebl/mandelbrot.ebl"; then
+if ! ./ebl-dofile "ebl/mandelbrot.ebl" "$@"; then
     exit 1
 fi